@@ -0,0 +1,46 @@
+#include <iostream>
+#include <string>
+
+#include "memory/allocation_stats.hpp"
+#include "server/render_server.hpp"
+
+// Renders the same request twice in one server, the second (warm) frame must not allocate while setting up or
+// rasterizing. Run from the repository root, so that the default model is found.
+int main(int argc, char **argv)
+{
+    const std::string output = argc > 1 ? argv[1] : "warm_frame.png";
+    const std::string request = "width=400 height=400 output=" + output;
+
+    RenderServer server;
+    const std::string cold_response = server.handle(request);
+    const RequestAllocations cold = server.last_allocations();
+    const std::string warm_response = server.handle(request);
+    const RequestAllocations warm = server.last_allocations();
+
+    std::cout << "Cold: " << cold_response << std::endl
+              << "Warm: " << warm_response << std::endl;
+
+    if (cold_response.compare(0, 3, "ok ") != 0 || warm_response.compare(0, 3, "ok ") != 0)
+    {
+        std::cout << "The request failed" << std::endl;
+        return 1;
+    }
+
+    // The cold frame has to create the framebuffers, so a count of zero means that the hook is not linked in
+    if (cold.setup.n_allocations == 0)
+    {
+        std::cout << "No allocations were counted in the cold frame" << std::endl;
+        return 1;
+    }
+
+    const size_t n_frame_allocations = warm.setup.n_allocations + warm.raster.n_allocations;
+    if (n_frame_allocations > 0)
+    {
+        std::cout << "The warm frame made " << n_frame_allocations << " allocations ("
+                  << warm.setup.n_bytes + warm.raster.n_bytes << " bytes)" << std::endl;
+        return 1;
+    }
+
+    std::cout << "The warm frame made no allocations" << std::endl;
+    return 0;
+}
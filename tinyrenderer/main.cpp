@@ -1,26 +1,270 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
 #include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <SFML/Graphics.hpp>
 
 #include "math/linalg.hpp"
-#include "rendering/model.hpp"
+#include "memory/frame_arena.hpp"
 #include "rendering/draw.hpp"
+#include "rendering/lighting.hpp"
+#include "rendering/model.hpp"
+#include "rendering/model_loader.hpp"
+#include "rendering/postprocess.hpp"
+#include "rendering/preview.hpp"
 #include "rendering/shader.hpp"
+#include "rendering/streaming.hpp"
+#include "server/render_server.hpp"
+#include "server/sort_last.hpp"
+
+// Directional light plus a ring of point and spot lights around the model
+std::vector<Light> make_light_ring(const FloatVector &direction, int n_lights)
+{
+    const FloatVector colors[] = {
+        FloatVector(1.f, .4f, .4f),
+        FloatVector(.4f, 1.f, .4f),
+        FloatVector(.4f, .4f, 1.f),
+        FloatVector(1.f, 1.f, .6f)};
+
+    std::vector<Light> lights = {Light::directional(direction, FloatVector(1.f, 1.f, 1.f), .5f)};
+    for (int i = 0; i < n_lights; ++i)
+    {
+        const float angle = 2.f * M_PI * i / n_lights, height = std::sin(angle * 3.f) * .8f;
+        const FloatVector position(std::cos(angle) * 1.2f, height, std::sin(angle) * 1.2f),
+            color = colors[i % 4];
+
+        if (i % 4 == 3)
+        {
+            lights.push_back(Light::spot(position, position * -1.f, color, 2.f, 1.5f, .3f, .5f));
+        }
+        else
+        {
+            lights.push_back(Light::point(position, color, 2.f, .6f));
+        }
+    }
+
+    return lights;
+}
+
+// The arguments of this run without --workers, for the worker processes
+std::vector<std::string> worker_command(int argc, char **argv)
+{
+    std::vector<std::string> command = {argv[0]};
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc)
+        {
+            ++i;
+            continue;
+        }
+
+        command.push_back(arg);
+    }
+
+    return command;
+}
 
-int main()
+int main(int argc, char **argv)
 {
     const int screen_width = 1600, screen_height = 1600;
 
+    bool draw_wireframe = false, compact_vertices = false, serve_stdin = false;
+    int n_lights = -1, n_preview_passes = 0;
+    std::string model_filename = "model/model.obj", compact_filename, chunks_filename, stream_filename, socket_path;
+    std::vector<std::string> preload_filenames;
+    size_t max_chunk_faces = 65536, memory_budget = 64 << 20;
+    size_t n_workers = 0, partition_idx = 0, n_partitions = 1;
+    bool is_worker = false;
+    PostProcessSettings post_settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--wireframe")
+        {
+            draw_wireframe = true;
+        }
+        else if (arg == "--lights" && i + 1 < argc)
+        {
+            n_lights = std::stoi(argv[++i]);
+        }
+        else if (arg == "--preview" && i + 1 < argc)
+        {
+            n_preview_passes = std::stoi(argv[++i]);
+        }
+        else if (arg == "--compact")
+        {
+            compact_vertices = true;
+        }
+        else if (arg == "--model" && i + 1 < argc)
+        {
+            model_filename = argv[++i];
+        }
+        else if (arg == "--save-compact" && i + 1 < argc)
+        {
+            compact_filename = argv[++i];
+        }
+        else if (arg == "--build-chunks" && i + 1 < argc)
+        {
+            chunks_filename = argv[++i];
+        }
+        else if (arg == "--chunk-faces" && i + 1 < argc)
+        {
+            max_chunk_faces = std::stoul(argv[++i]);
+        }
+        else if (arg == "--stream" && i + 1 < argc)
+        {
+            stream_filename = argv[++i];
+        }
+        else if (arg == "--memory-budget" && i + 1 < argc)
+        {
+            memory_budget = std::stoul(argv[++i]);
+        }
+        else if (arg == "--tonemap" && i + 1 < argc)
+        {
+            post_settings.tone_mapping = true;
+            post_settings.exposure = std::stof(argv[++i]);
+        }
+        else if (arg == "--bloom" && i + 1 < argc)
+        {
+            post_settings.bloom_strength = std::stof(argv[++i]);
+        }
+        else if (arg == "--dof" && i + 1 < argc)
+        {
+            post_settings.dof_range = std::stof(argv[++i]);
+        }
+        else if (arg == "--fxaa")
+        {
+            post_settings.fxaa = true;
+        }
+        else if (arg == "--serve")
+        {
+            serve_stdin = true;
+        }
+        else if (arg == "--serve-socket" && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--preload" && i + 1 < argc)
+        {
+            preload_filenames.push_back(argv[++i]);
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            n_workers = std::stoul(argv[++i]);
+        }
+        else if (arg == "--worker" && i + 1 < argc)
+        {
+            // Partition I of N, set by the compositor
+            const std::string partition = argv[++i];
+            const size_t slash = partition.find('/');
+            if (slash == std::string::npos)
+            {
+                throw std::runtime_error("Invalid worker partition");
+            }
+
+            partition_idx = std::stoul(partition.substr(0, slash));
+            n_partitions = std::stoul(partition.substr(slash + 1));
+            if (partition_idx >= n_partitions)
+            {
+                throw std::runtime_error("Invalid worker partition");
+            }
+
+            is_worker = true;
+        }
+    }
+
+    // A worker writes its frame to standard output, everything it prints goes to standard error instead
+    std::ostream layer_stream(std::cout.rdbuf());
+    if (is_worker)
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
+    if (serve_stdin || !socket_path.empty())
+    {
+        RenderServer server;
+        for (const std::string &problem : server.preload(preload_filenames))
+        {
+            std::cerr << "Preload: " << problem << std::endl;
+        }
+
+        if (socket_path.empty())
+        {
+            server.serve(std::cin, std::cout);
+        }
+        else
+        {
+            server.serve_socket(socket_path);
+        }
+
+        return 0;
+    }
+
+    if (!chunks_filename.empty())
+    {
+        // Caught here rather than left to terminate, so the build unwinds and removes its temporary files
+        try
+        {
+            ChunkedMesh::build(model_filename, chunks_filename, max_chunk_faces, memory_budget);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to build the chunks: " << e.what() << std::endl;
+            return 1;
+        }
+
+        std::cout << "Chunks: " << ChunkedMesh(chunks_filename).chunks().size() << std::endl;
+        return 0;
+    }
+
+    // Every chunk is dropped once it is drawn, which leaves no edges to draw the wireframe from
+    if (!stream_filename.empty() && draw_wireframe)
+    {
+        throw std::runtime_error("--stream does not support --wireframe");
+    }
+
+    // Sort-last rendering of a chunked mesh: worker processes render their share of the chunks, their frames are
+    // composited here by depth and post-processed like a single frame
+    if (n_workers > 0 && (stream_filename.empty() || draw_wireframe || n_preview_passes > 0))
+    {
+        throw std::runtime_error("--workers needs --stream and does not support --wireframe or --preview");
+    }
+
+    if (n_workers > max_sort_last_workers())
+    {
+        throw std::runtime_error("--workers can be at most " + std::to_string(max_sort_last_workers()));
+    }
+
+    // Loaded in the background while the framebuffers are set up. When streaming, the model only holds the maps
+    // and the chunk that is being drawn.
+    std::optional<ModelHandle> model_handle;
+    if (n_workers == 0 && stream_filename.empty())
+    {
+        model_handle.emplace(
+            model_filename,
+            "model/normal_map.png",
+            "model/specular_map.png",
+            "model/diffuse_map.png",
+            true,
+            compact_vertices);
+    }
+    else if (n_workers == 0)
+    {
+        model_handle.emplace(
+            "model/normal_map.png",
+            "model/specular_map.png",
+            "model/diffuse_map.png");
+    }
+
     sf::Image screen;
     screen.create(screen_width, screen_height, sf::Color::Black);
 
-    Model model(
-        "model/model.obj",
-        "model/normal_map.png",
-        "model/specular_map.png",
-        "model/diffuse_map.png");
-
     const float ambient_const = 3.f, diffusion_const = 1.2f, specular_const = .6f;
 
     const FloatVector eye(1.f, 1.f, 3.f),
@@ -37,30 +281,175 @@ int main()
                      screen_width * 3 / 4,
                      screen_height * 3 / 4);
 
-    NormalShader shader(
-        model,
-        model_mat,
-        view_mat,
-        proj_mat,
-        viewport_mat,
-        light,
-        ambient_const,
-        diffusion_const,
-        specular_const);
-
     std::vector<std::vector<float>> zbuf(
         screen_width,
         std::vector<float>(screen_height, -std::numeric_limits<float>::max()));
 
-    for (size_t face_idx = 0; face_idx < model.faces.size(); ++face_idx)
+    // Transient data of the passes, e.g. the cluster order and the visibility buffer of the preview
+    FrameArena frame_arena;
+
+    std::vector<LineSegment> wireframe_edges;
+    if (n_workers > 0)
+    {
+        const auto composite_start_time = std::chrono::steady_clock::now();
+        render_sort_last(worker_command(argc, argv), n_workers, screen, zbuf);
+        const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - composite_start_time);
+        std::cout << "Sort-last: " << n_workers << " workers, " << elapsed.count() << " ms" << std::endl;
+    }
+    else
     {
-        Triangle screen_coords;
-        for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+        // The maps are only needed by the shading passes
+        Model &model = model_handle->wait(MODEL_GEOMETRY);
+
+        if (model.is_compact && stream_filename.empty())
         {
-            screen_coords[vertex_idx] = shader.vertex(face_idx, vertex_idx);
+            std::cout << "Vertex memory: " << model.vertex_memory() << " bytes for " << model.n_faces() << " faces" << std::endl;
         }
 
-        draw_triangle(screen, screen_coords, zbuf, shader);
+        if (!compact_filename.empty())
+        {
+            model.save_compact(compact_filename);
+        }
+
+        // The model matrix is the identity, so the eye is already in model space
+        const auto start_time = std::chrono::steady_clock::now();
+        auto draw_geometry = [&](Shader &shader)
+        {
+            if (stream_filename.empty())
+            {
+                draw_model(screen, model, zbuf, shader, eye, frame_arena);
+                return;
+            }
+
+            const StreamingStats stats = draw_streamed(
+                screen,
+                zbuf,
+                model,
+                shader,
+                ChunkedMesh(stream_filename),
+                viewport_mat * proj_mat * view_mat * model_mat,
+                eye,
+                memory_budget,
+                partition_idx,
+                n_partitions);
+            std::cout << "Chunks: " << stats.n_chunks << " (" << stats.n_culled << " culled, "
+                      << stats.n_prefetched << " read ahead), peak resident " << stats.peak_resident_bytes << " bytes" << std::endl;
+        };
+
+        // Progressive previews need the whole model, so streamed renders are always drawn in one go
+        auto draw = [&](Shader &shader)
+        {
+            if (n_preview_passes <= 0 || !stream_filename.empty())
+            {
+                draw_geometry(shader);
+                return;
+            }
+
+            auto save_preview = [&start_time](const sf::Image &preview, size_t pass, size_t n_passes)
+            {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start_time);
+                std::cout << "Preview pass " << pass + 1 << " / " << n_passes << ": " << elapsed.count() << " ms" << std::endl;
+
+                sf::Image flipped = preview;
+                flipped.flipVertically();
+                flipped.saveToFile("preview_" + std::to_string(pass + 1) + ".png");
+            };
+
+            draw_model_progressive(screen, model, zbuf, shader, eye, n_preview_passes, save_preview, frame_arena);
+        };
+
+        if (n_lights < 0)
+        {
+            model_handle->wait();
+            NormalShader shader(
+                model,
+                model_mat,
+                view_mat,
+                proj_mat,
+                viewport_mat,
+                light,
+                ambient_const,
+                diffusion_const,
+                specular_const);
+
+            draw(shader);
+        }
+        else
+        {
+            // Depth pre-pass, the tile depth ranges are needed for light culling
+            // and every pixel ends up shaded only once
+            DepthShader depth_shader(model, model_mat, view_mat, proj_mat, viewport_mat);
+            draw_geometry(depth_shader);
+
+            const std::vector<Light> lights = make_light_ring(light, n_lights);
+            LightGrid light_grid(screen_width, screen_height);
+            light_grid.build(lights, viewport_mat * proj_mat * view_mat, zbuf);
+
+            const LightingStats &stats = light_grid.stats();
+            std::cout << "Lights: " << stats.n_lights << " (" << stats.n_global_lights << " global)" << std::endl
+                      << "Occupied tiles: " << stats.n_occupied_tiles << " / " << stats.n_tiles << std::endl
+                      << "Lights per tile: " << stats.mean_tile_lights() << " mean, " << stats.max_tile_lights << " max" << std::endl;
+
+            model_handle->wait();
+            MultiLightShader shader(
+                model,
+                model_mat,
+                view_mat,
+                proj_mat,
+                viewport_mat,
+                lights,
+                light_grid,
+                eye,
+                ambient_const,
+                diffusion_const,
+                specular_const);
+
+            draw(shader);
+        }
+
+        if (draw_wireframe)
+        {
+            const Matrix transformation_mat = viewport_mat * proj_mat * view_mat * model_mat;
+
+            // Edges that pass behind the eye are cut before the perspective divide, the rest is clipped to the
+            // screen when drawn
+            wireframe_edges = model.edges();
+            size_t n_projected = 0;
+            for (auto &edge : wireframe_edges)
+            {
+                if (edge.project(transformation_mat))
+                {
+                    wireframe_edges[n_projected++] = edge;
+                }
+            }
+
+            wireframe_edges.resize(n_projected);
+        }
+    }
+
+    // Post-processing needs the whole frame, so it is left to the compositor
+    if (is_worker)
+    {
+        write_layer(layer_stream, screen, zbuf);
+        return 0;
+    }
+
+    if (post_settings.enabled())
+    {
+        PostProcessor post_processor(post_settings);
+        post_processor.apply(screen, zbuf);
+
+        const PostProcessTimings &timings = post_processor.last_timings();
+        std::cout << "Post-processing: " << timings.total << " ms (depth range " << timings.depth_range
+                  << " ms, downsample " << timings.downsample << " ms, blur " << timings.blur
+                  << " ms, composite " << timings.composite << " ms, FXAA " << timings.fxaa << " ms)" << std::endl;
+    }
+
+    // Drawn after post-processing, so the lines stay sharp
+    if (draw_wireframe)
+    {
+        draw_lines(screen, wireframe_edges, sf::Color::Green, zbuf);
     }
 
     screen.flipVertically();
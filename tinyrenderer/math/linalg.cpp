@@ -2,7 +2,13 @@
 
 #include "math/linalg.hpp"
 
-Matrix::Matrix(size_t rows, size_t cols) : mat(rows, std::vector<float>(cols, 0.f)) {}
+Matrix::Matrix(size_t rows, size_t cols) : rows(rows), cols(cols), mat{}
+{
+    if (rows == 0 || cols == 0 || rows > max_matrix_rows || cols > max_matrix_cols)
+    {
+        throw std::runtime_error("Unsupported matrix dimensions");
+    }
+}
 
 Matrix::Matrix(const FloatVector &vec) : Matrix(VectorComponent::W + 1, 1)
 {
@@ -40,12 +46,12 @@ Matrix Matrix::operator*(const Matrix &other) const
     return result;
 }
 
-std::vector<float> &Matrix::operator[](size_t idx)
+float *Matrix::operator[](size_t idx)
 {
     return mat[idx];
 }
 
-const std::vector<float> &Matrix::at(size_t idx) const
+const float *Matrix::at(size_t idx) const
 {
     return mat[idx];
 }
@@ -95,7 +101,7 @@ Matrix Matrix::inv() const
             continue;
         }
 
-        std::swap(gaussian[pivot_row], gaussian[max_row]);
+        std::swap_ranges(gaussian[pivot_row], gaussian[pivot_row] + gaussian.n_cols(), gaussian[max_row]);
         for (size_t i = pivot_row + 1; i < n_rows(); ++i)
         {
             const float ratio = gaussian[i][pivot_col] / gaussian[pivot_row][pivot_col];
@@ -124,12 +130,12 @@ Matrix Matrix::inv() const
 
 size_t Matrix::n_rows() const
 {
-    return mat.size();
+    return rows;
 }
 
 size_t Matrix::n_cols() const
 {
-    return mat[0].size();
+    return cols;
 }
 
 FloatVector Matrix::to_vector() const
@@ -148,6 +154,56 @@ FloatVector Matrix::to_vector() const
     return result;
 }
 
+FloatVector Matrix::transform(const FloatVector &vec) const
+{
+    float w = 0.f;
+    return transform(vec, w);
+}
+
+FloatVector Matrix::transform(const FloatVector &vec, float &w) const
+{
+    if (n_cols() != VectorComponent::W + 1 || n_rows() != VectorComponent::W + 1)
+    {
+        throw std::runtime_error("Can only transform a vector with a 4x4 matrix");
+    }
+
+    // Same as (*this * Matrix(vec)).to_vector(), without the temporary matrices
+    float result[VectorComponent::W + 1];
+    for (size_t i = 0; i <= VectorComponent::W; ++i)
+    {
+        const float *row = mat[i];
+        float val = 0.f;
+        val += row[VectorComponent::X] * vec.x;
+        val += row[VectorComponent::Y] * vec.y;
+        val += row[VectorComponent::Z] * vec.z;
+        val += row[VectorComponent::W] * 1.f;
+        result[i] = val;
+    }
+
+    w = result[VectorComponent::W];
+    return FloatVector(
+        result[VectorComponent::X] / result[VectorComponent::W],
+        result[VectorComponent::Y] / result[VectorComponent::W],
+        result[VectorComponent::Z] / result[VectorComponent::W]);
+}
+
+FloatVector Matrix::transform_direction(const FloatVector &vec) const
+{
+    if (n_cols() < VectorComponent::Z + 1 || n_rows() < VectorComponent::Z + 1)
+    {
+        throw std::runtime_error("Can only transform a direction with at least a 3x3 matrix");
+    }
+
+    // Only the upper left 3x3 block is applied, directions are not translated
+    FloatVector result;
+    for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+    {
+        result[i] = mat[i][VectorComponent::X] * vec.x + mat[i][VectorComponent::Y] * vec.y + mat[i][VectorComponent::Z] * vec.z;
+    }
+
+    return result;
+}
+
 Matrix Matrix::identity(size_t size)
 {
     Matrix result(size, size);
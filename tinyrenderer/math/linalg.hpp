@@ -1,10 +1,14 @@
 #ifndef __VECTOR_HPP__
 #define __VECTOR_HPP__
 
+#include <cassert>
 #include <cmath>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#include "math/simd.hpp"
+
 enum VectorComponent
 {
     X,
@@ -56,34 +60,24 @@ struct Vector
         return std::sqrt(ref * ref);
     }
 
+    // Components are looked up through a table of member pointers instead of a switch,
+    // the index is only checked in debug builds
     T &operator[](size_t idx)
     {
-        switch (idx)
-        {
-        case VectorComponent::X:
-            return x;
-        case VectorComponent::Y:
-            return y;
-        case VectorComponent::Z:
-            return z;
-        default:
-            throw std::runtime_error("Invalid vector component index");
-        }
+        assert(idx <= VectorComponent::Z && "Invalid vector component index");
+        return this->*components[idx];
     }
 
     const T at(size_t idx) const
     {
-        switch (idx)
-        {
-        case VectorComponent::X:
-            return x;
-        case VectorComponent::Y:
-            return y;
-        case VectorComponent::Z:
-            return z;
-        default:
-            throw std::runtime_error("Invalid vector component index");
-        }
+        assert(idx <= VectorComponent::Z && "Invalid vector component index");
+        return this->*components[idx];
+    }
+
+    // False if any component is NaN or infinite
+    bool is_finite() const
+    {
+        return std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
     }
 
     Vector<T> normalize() const
@@ -91,28 +85,102 @@ struct Vector
         const T vec_norm = norm();
         return Vector<T>(x / vec_norm, y / vec_norm, z / vec_norm);
     }
+
+    // Approximate normalization through the reciprocal square root, meant for the shading hot path
+    Vector<T> fast_normalize() const
+    {
+        static_assert(std::is_same<T, float>::value, "Only float vectors can be normalized approximately");
+        const Vector<T> &ref = *this;
+        return ref * inverse_sqrt(ref * ref);
+    }
+
+private:
+    static constexpr T Vector<T>::*components[] = {&Vector<T>::x, &Vector<T>::y, &Vector<T>::z};
 };
 
 using IntVector = Vector<int>;
 using FloatVector = Vector<float>;
 
+// Structure of arrays vector, holds eight FloatVectors for block-wide shading
+struct FloatVector8
+{
+    Float8 x, y, z;
+
+    FloatVector8() {}
+    FloatVector8(const Float8 &x, const Float8 &y, const Float8 &z) : x(x), y(y), z(z) {}
+    FloatVector8(const FloatVector &vec) : x(vec.x), y(vec.y), z(vec.z) {}
+
+    FloatVector8 operator+(const FloatVector8 &other) const
+    {
+        return FloatVector8(x + other.x, y + other.y, z + other.z);
+    }
+
+    FloatVector8 operator-(const FloatVector8 &other) const
+    {
+        return FloatVector8(x - other.x, y - other.y, z - other.z);
+    }
+
+    FloatVector8 operator*(const Float8 &constant) const
+    {
+        return FloatVector8(x * constant, y * constant, z * constant);
+    }
+
+    Float8 operator*(const FloatVector8 &other) const
+    {
+        return x * other.x + y * other.y + z * other.z;
+    }
+
+    // Same operation order as Vector<T>::operator^, so the lanes match the scalar results exactly
+    FloatVector8 operator^(const FloatVector8 &other) const
+    {
+        return FloatVector8(
+            y * other.z - other.y * z,
+            -x * other.z + other.x * z,
+            x * other.y - other.x * y);
+    }
+
+    FloatVector8 normalize() const
+    {
+        const FloatVector8 &ref = *this;
+        return ref * (ref * ref).inverse_sqrt();
+    }
+
+    FloatVector lane(size_t idx) const
+    {
+        float xs[Float8::size], ys[Float8::size], zs[Float8::size];
+        x.store(xs);
+        y.store(ys);
+        z.store(zs);
+        return FloatVector(xs[idx], ys[idx], zs[idx]);
+    }
+};
+
+// Largest matrix dimensions, inv() needs twice the columns of the matrix for its augmented matrix
+const size_t max_matrix_rows = 4, max_matrix_cols = 8;
+
+// The values are stored inline, so matrices and their temporaries never allocate
 class Matrix
 {
 private:
-    std::vector<std::vector<float>> mat;
+    size_t rows, cols;
+    float mat[max_matrix_rows][max_matrix_cols];
 
 public:
     Matrix(size_t rows, size_t cols);
     Matrix(const FloatVector &vec);
 
     Matrix operator*(const Matrix &other) const;
-    std::vector<float> &operator[](size_t idx);
-    const std::vector<float> &at(size_t idx) const;
+    float *operator[](size_t idx);
+    const float *at(size_t idx) const;
     Matrix T() const;
     Matrix inv() const;
     size_t n_rows() const;
     size_t n_cols() const;
     FloatVector to_vector() const;
+    FloatVector transform(const FloatVector &vec) const;
+    // Also gives the w the result was divided by, needed for perspective correct interpolation
+    FloatVector transform(const FloatVector &vec, float &w) const;
+    FloatVector transform_direction(const FloatVector &vec) const;
 
     static Matrix identity(size_t size);
     static Matrix look_at(const FloatVector &eye, const FloatVector &center, const FloatVector up);
@@ -0,0 +1,103 @@
+#include <algorithm>
+
+#include "math/segment.hpp"
+
+LineSegment::LineSegment() {}
+
+LineSegment::LineSegment(const FloatVector p0, const FloatVector p1) : p0(p0), p1(p1) {}
+
+bool LineSegment::project(const Matrix &transformation_mat, float min_w)
+{
+    float homogeneous[2][VectorComponent::W + 1];
+    FloatVector *points[2] = {&p0, &p1};
+    for (size_t point_idx = 0; point_idx < 2; ++point_idx)
+    {
+        const Matrix projected = transformation_mat * Matrix(*points[point_idx]);
+        for (size_t i = VectorComponent::X; i <= VectorComponent::W; ++i)
+        {
+            homogeneous[point_idx][i] = projected.at(i)[0];
+        }
+    }
+
+    const float w0 = homogeneous[0][VectorComponent::W], w1 = homogeneous[1][VectorComponent::W];
+    if (w0 < min_w && w1 < min_w)
+    {
+        return false;
+    }
+
+    // w is linear along the segment before the divide, so the cut is where it reaches min_w
+    if (w0 < min_w || w1 < min_w)
+    {
+        const float t = (min_w - w0) / (w1 - w0);
+        float *cut = homogeneous[w0 < min_w ? 0 : 1];
+        for (size_t i = VectorComponent::X; i <= VectorComponent::W; ++i)
+        {
+            cut[i] = homogeneous[0][i] + (homogeneous[1][i] - homogeneous[0][i]) * t;
+        }
+    }
+
+    for (size_t point_idx = 0; point_idx < 2; ++point_idx)
+    {
+        const float *point = homogeneous[point_idx];
+        *points[point_idx] = FloatVector(
+            point[VectorComponent::X] / point[VectorComponent::W],
+            point[VectorComponent::Y] / point[VectorComponent::W],
+            point[VectorComponent::Z] / point[VectorComponent::W]);
+    }
+
+    return true;
+}
+
+bool LineSegment::clip(float x_min, float y_min, float x_max, float y_max)
+{
+    // NaN fails every comparison below and would be kept as if it were inside, infinities turn into NaN in delta
+    if (!p0.is_finite() || !p1.is_finite())
+    {
+        return false;
+    }
+
+    // Liang-Barsky, z is clipped along with x and y
+    const FloatVector delta = p1 - p0;
+    const float directions[4] = {-delta.x, delta.x, -delta.y, delta.y},
+                distances[4] = {p0.x - x_min, x_max - p0.x, p0.y - y_min, y_max - p0.y};
+
+    float t0 = 0.f, t1 = 1.f;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (directions[i] == 0.f)
+        {
+            if (distances[i] < 0.f)
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        const float t = distances[i] / directions[i];
+        if (directions[i] < 0.f)
+        {
+            if (t > t1)
+            {
+                return false;
+            }
+
+            t0 = std::max(t0, t);
+        }
+        else
+        {
+            if (t < t0)
+            {
+                return false;
+            }
+
+            t1 = std::min(t1, t);
+        }
+    }
+
+    const FloatVector start = p0;
+    p0 = start + delta * t0;
+    p1 = start + delta * t1;
+
+    return true;
+}
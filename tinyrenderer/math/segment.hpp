@@ -0,0 +1,21 @@
+#ifndef __SEGMENT_HPP__
+#define __SEGMENT_HPP__
+
+#include "math/linalg.hpp"
+
+struct LineSegment
+{
+    FloatVector p0, p1;
+
+    LineSegment();
+    LineSegment(const FloatVector p0, const FloatVector p1);
+
+    // Transforms the segment with a projective matrix. The part with w below min_w, behind the eye or too close
+    // to it, is cut off before the perspective divide would flip it. False if nothing of the segment is left.
+    bool project(const Matrix &transformation_mat, float min_w = 1e-3f);
+
+    // Clips the segment to the rectangle, false if nothing of it is left or an endpoint is not finite
+    bool clip(float x_min, float y_min, float x_max, float y_max);
+};
+
+#endif
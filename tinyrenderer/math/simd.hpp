@@ -0,0 +1,334 @@
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define TINYRENDERER_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define TINYRENDERER_NEON
+#include <arm_neon.h>
+#endif
+
+// Eight float lanes, backed by two 128-bit registers when SSE or NEON is available
+struct Float8
+{
+    static const size_t size = 8;
+
+#if defined(TINYRENDERER_SSE)
+    __m128 lo, hi;
+
+    Float8() : lo(_mm_setzero_ps()), hi(_mm_setzero_ps()) {}
+    Float8(float value) : lo(_mm_set1_ps(value)), hi(_mm_set1_ps(value)) {}
+    Float8(__m128 lo, __m128 hi) : lo(lo), hi(hi) {}
+
+    static Float8 load(const float *ptr) { return Float8(_mm_loadu_ps(ptr), _mm_loadu_ps(ptr + 4)); }
+    void store(float *ptr) const
+    {
+        _mm_storeu_ps(ptr, lo);
+        _mm_storeu_ps(ptr + 4, hi);
+    }
+
+    Float8 operator+(const Float8 &other) const { return Float8(_mm_add_ps(lo, other.lo), _mm_add_ps(hi, other.hi)); }
+    Float8 operator-(const Float8 &other) const { return Float8(_mm_sub_ps(lo, other.lo), _mm_sub_ps(hi, other.hi)); }
+    Float8 operator*(const Float8 &other) const { return Float8(_mm_mul_ps(lo, other.lo), _mm_mul_ps(hi, other.hi)); }
+    Float8 operator/(const Float8 &other) const { return Float8(_mm_div_ps(lo, other.lo), _mm_div_ps(hi, other.hi)); }
+    Float8 operator-() const
+    {
+        const __m128 sign = _mm_set1_ps(-0.f);
+        return Float8(_mm_xor_ps(lo, sign), _mm_xor_ps(hi, sign));
+    }
+
+    Float8 min(const Float8 &other) const { return Float8(_mm_min_ps(lo, other.lo), _mm_min_ps(hi, other.hi)); }
+    Float8 max(const Float8 &other) const { return Float8(_mm_max_ps(lo, other.lo), _mm_max_ps(hi, other.hi)); }
+
+    // a0 + a1, a2 + a3, a4 + a5, a6 + a7, b0 + b1, ..., b6 + b7
+    static Float8 pairwise_sum(const Float8 &a, const Float8 &b)
+    {
+        return Float8(
+            _mm_add_ps(_mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(3, 1, 3, 1))),
+            _mm_add_ps(_mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+
+    // Writes sixteen floats: even0, odd0, even1, odd1, ...
+    static void store_interleaved(float *ptr, const Float8 &even, const Float8 &odd)
+    {
+        _mm_storeu_ps(ptr, _mm_unpacklo_ps(even.lo, odd.lo));
+        _mm_storeu_ps(ptr + 4, _mm_unpackhi_ps(even.lo, odd.lo));
+        _mm_storeu_ps(ptr + 8, _mm_unpacklo_ps(even.hi, odd.hi));
+        _mm_storeu_ps(ptr + 12, _mm_unpackhi_ps(even.hi, odd.hi));
+    }
+
+    // Bit i is set if lane i is less than zero
+    int negative_mask() const
+    {
+        const __m128 zero = _mm_setzero_ps();
+        return _mm_movemask_ps(_mm_cmplt_ps(lo, zero)) | (_mm_movemask_ps(_mm_cmplt_ps(hi, zero)) << 4);
+    }
+
+    Float8 inverse_sqrt() const
+    {
+        // The hardware estimate is refined with one Newton-Raphson step
+        const __m128 half = _mm_set1_ps(.5f), three_halves = _mm_set1_ps(1.5f);
+        const __m128 est_lo = _mm_rsqrt_ps(lo), est_hi = _mm_rsqrt_ps(hi);
+        return Float8(
+            _mm_mul_ps(est_lo, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, lo), _mm_mul_ps(est_lo, est_lo)))),
+            _mm_mul_ps(est_hi, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, hi), _mm_mul_ps(est_hi, est_hi)))));
+    }
+#elif defined(TINYRENDERER_NEON)
+    float32x4_t lo, hi;
+
+    Float8() : lo(vdupq_n_f32(0.f)), hi(vdupq_n_f32(0.f)) {}
+    Float8(float value) : lo(vdupq_n_f32(value)), hi(vdupq_n_f32(value)) {}
+    Float8(float32x4_t lo, float32x4_t hi) : lo(lo), hi(hi) {}
+
+    static Float8 load(const float *ptr) { return Float8(vld1q_f32(ptr), vld1q_f32(ptr + 4)); }
+    void store(float *ptr) const
+    {
+        vst1q_f32(ptr, lo);
+        vst1q_f32(ptr + 4, hi);
+    }
+
+    Float8 operator+(const Float8 &other) const { return Float8(vaddq_f32(lo, other.lo), vaddq_f32(hi, other.hi)); }
+    Float8 operator-(const Float8 &other) const { return Float8(vsubq_f32(lo, other.lo), vsubq_f32(hi, other.hi)); }
+    Float8 operator*(const Float8 &other) const { return Float8(vmulq_f32(lo, other.lo), vmulq_f32(hi, other.hi)); }
+    Float8 operator/(const Float8 &other) const
+    {
+        float lhs[size], rhs[size];
+        store(lhs);
+        other.store(rhs);
+        for (size_t i = 0; i < size; ++i)
+        {
+            lhs[i] /= rhs[i];
+        }
+
+        return load(lhs);
+    }
+    Float8 operator-() const { return Float8(vnegq_f32(lo), vnegq_f32(hi)); }
+
+    Float8 min(const Float8 &other) const { return Float8(vminq_f32(lo, other.lo), vminq_f32(hi, other.hi)); }
+    Float8 max(const Float8 &other) const { return Float8(vmaxq_f32(lo, other.lo), vmaxq_f32(hi, other.hi)); }
+
+    static Float8 pairwise_sum(const Float8 &a, const Float8 &b)
+    {
+        return Float8(
+            vcombine_f32(vpadd_f32(vget_low_f32(a.lo), vget_high_f32(a.lo)), vpadd_f32(vget_low_f32(a.hi), vget_high_f32(a.hi))),
+            vcombine_f32(vpadd_f32(vget_low_f32(b.lo), vget_high_f32(b.lo)), vpadd_f32(vget_low_f32(b.hi), vget_high_f32(b.hi))));
+    }
+
+    static void store_interleaved(float *ptr, const Float8 &even, const Float8 &odd)
+    {
+        vst2q_f32(ptr, float32x4x2_t{{even.lo, odd.lo}});
+        vst2q_f32(ptr + 8, float32x4x2_t{{even.hi, odd.hi}});
+    }
+
+    int negative_mask() const
+    {
+        const uint32x4_t bit_values = {1, 2, 4, 8};
+        const float32x4_t zero = vdupq_n_f32(0.f);
+        const uint32x4_t mask_lo = vandq_u32(vcltq_f32(lo, zero), bit_values),
+                         mask_hi = vandq_u32(vcltq_f32(hi, zero), bit_values);
+        const uint32x2_t sum_lo = vpadd_u32(vget_low_u32(mask_lo), vget_high_u32(mask_lo)),
+                         sum_hi = vpadd_u32(vget_low_u32(mask_hi), vget_high_u32(mask_hi));
+        return (vget_lane_u32(sum_lo, 0) + vget_lane_u32(sum_lo, 1)) |
+               ((vget_lane_u32(sum_hi, 0) + vget_lane_u32(sum_hi, 1)) << 4);
+    }
+
+    Float8 inverse_sqrt() const
+    {
+        float32x4_t est_lo = vrsqrteq_f32(lo), est_hi = vrsqrteq_f32(hi);
+        est_lo = vmulq_f32(est_lo, vrsqrtsq_f32(vmulq_f32(lo, est_lo), est_lo));
+        est_hi = vmulq_f32(est_hi, vrsqrtsq_f32(vmulq_f32(hi, est_hi), est_hi));
+        return Float8(est_lo, est_hi);
+    }
+#else
+    float lanes[size];
+
+    Float8() : Float8(0.f) {}
+    Float8(float value)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            lanes[i] = value;
+        }
+    }
+
+    static Float8 load(const float *ptr)
+    {
+        Float8 result;
+        for (size_t i = 0; i < size; ++i)
+        {
+            result.lanes[i] = ptr[i];
+        }
+
+        return result;
+    }
+    void store(float *ptr) const
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            ptr[i] = lanes[i];
+        }
+    }
+
+    template <typename Op>
+    Float8 apply(const Float8 &other, Op op) const
+    {
+        Float8 result;
+        for (size_t i = 0; i < size; ++i)
+        {
+            result.lanes[i] = op(lanes[i], other.lanes[i]);
+        }
+
+        return result;
+    }
+
+    Float8 operator+(const Float8 &other) const { return apply(other, [](float a, float b) { return a + b; }); }
+    Float8 operator-(const Float8 &other) const { return apply(other, [](float a, float b) { return a - b; }); }
+    Float8 operator*(const Float8 &other) const { return apply(other, [](float a, float b) { return a * b; }); }
+    Float8 operator/(const Float8 &other) const { return apply(other, [](float a, float b) { return a / b; }); }
+    Float8 operator-() const { return apply(*this, [](float a, float) { return -a; }); }
+
+    Float8 min(const Float8 &other) const { return apply(other, [](float a, float b) { return b < a ? b : a; }); }
+    Float8 max(const Float8 &other) const { return apply(other, [](float a, float b) { return a < b ? b : a; }); }
+
+    static Float8 pairwise_sum(const Float8 &a, const Float8 &b)
+    {
+        Float8 result;
+        for (size_t i = 0; i < size / 2; ++i)
+        {
+            result.lanes[i] = a.lanes[2 * i] + a.lanes[2 * i + 1];
+            result.lanes[i + size / 2] = b.lanes[2 * i] + b.lanes[2 * i + 1];
+        }
+
+        return result;
+    }
+
+    static void store_interleaved(float *ptr, const Float8 &even, const Float8 &odd)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            ptr[2 * i] = even.lanes[i];
+            ptr[2 * i + 1] = odd.lanes[i];
+        }
+    }
+
+    int negative_mask() const
+    {
+        int mask = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            mask |= (lanes[i] < 0.f) << i;
+        }
+
+        return mask;
+    }
+
+    Float8 inverse_sqrt() const { return apply(*this, [](float a, float) { return 1.f / std::sqrt(a); }); }
+#endif
+
+    // start, start + step, ..., start + 7 * step
+    static Float8 ramp(float start, float step)
+    {
+        float values[size];
+        for (size_t i = 0; i < size; ++i)
+        {
+            values[i] = start + i * step;
+        }
+
+        return load(values);
+    }
+};
+
+// Eight RGBA pixels with 8-bit channels, unpacked into one float lane per pixel
+struct Pixels8
+{
+    Float8 red, green, blue, alpha;
+
+    static Pixels8 load(const std::uint8_t *ptr)
+    {
+        Pixels8 pixels;
+#if defined(TINYRENDERER_SSE)
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr)),
+                      hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 16)),
+                      mask = _mm_set1_epi32(0xff);
+        pixels.red = Float8(_mm_cvtepi32_ps(_mm_and_si128(lo, mask)), _mm_cvtepi32_ps(_mm_and_si128(hi, mask)));
+        pixels.green = Float8(
+            _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(lo, 8), mask)),
+            _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(hi, 8), mask)));
+        pixels.blue = Float8(
+            _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(lo, 16), mask)),
+            _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(hi, 16), mask)));
+        pixels.alpha = Float8(_mm_cvtepi32_ps(_mm_srli_epi32(lo, 24)), _mm_cvtepi32_ps(_mm_srli_epi32(hi, 24)));
+#elif defined(TINYRENDERER_NEON)
+        const uint8x8x4_t channels = vld4_u8(ptr);
+        Float8 *unpacked[] = {&pixels.red, &pixels.green, &pixels.blue, &pixels.alpha};
+        for (size_t channel = 0; channel < 4; ++channel)
+        {
+            const uint16x8_t wide = vmovl_u8(channels.val[channel]);
+            *unpacked[channel] = Float8(
+                vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide))),
+                vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide))));
+        }
+#else
+        for (size_t i = 0; i < Float8::size; ++i)
+        {
+            pixels.red.lanes[i] = ptr[i * 4];
+            pixels.green.lanes[i] = ptr[i * 4 + 1];
+            pixels.blue.lanes[i] = ptr[i * 4 + 2];
+            pixels.alpha.lanes[i] = ptr[i * 4 + 3];
+        }
+#endif
+        return pixels;
+    }
+
+    // Channels are rounded to the nearest integer and must already be within [0, 255]
+    void store(std::uint8_t *ptr) const
+    {
+        const Float8 half(.5f);
+#if defined(TINYRENDERER_SSE)
+        auto pack = [](const __m128 &r, const __m128 &g, const __m128 &b, const __m128 &a)
+        {
+            return _mm_or_si128(
+                _mm_or_si128(_mm_cvttps_epi32(r), _mm_slli_epi32(_mm_cvttps_epi32(g), 8)),
+                _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(b), 16), _mm_slli_epi32(_mm_cvttps_epi32(a), 24)));
+        };
+        const Float8 r = red + half, g = green + half, b = blue + half, a = alpha + half;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr), pack(r.lo, g.lo, b.lo, a.lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + 16), pack(r.hi, g.hi, b.hi, a.hi));
+#elif defined(TINYRENDERER_NEON)
+        auto narrow = [&half](const Float8 &channel)
+        {
+            const Float8 rounded = channel + half;
+            return vmovn_u16(vcombine_u16(vmovn_u32(vcvtq_u32_f32(rounded.lo)), vmovn_u32(vcvtq_u32_f32(rounded.hi))));
+        };
+        vst4_u8(ptr, uint8x8x4_t{{narrow(red), narrow(green), narrow(blue), narrow(alpha)}});
+#else
+        for (size_t i = 0; i < Float8::size; ++i)
+        {
+            ptr[i * 4] = static_cast<std::uint8_t>(red.lanes[i] + half.lanes[i]);
+            ptr[i * 4 + 1] = static_cast<std::uint8_t>(green.lanes[i] + half.lanes[i]);
+            ptr[i * 4 + 2] = static_cast<std::uint8_t>(blue.lanes[i] + half.lanes[i]);
+            ptr[i * 4 + 3] = static_cast<std::uint8_t>(alpha.lanes[i] + half.lanes[i]);
+        }
+#endif
+    }
+};
+
+inline float inverse_sqrt(float value)
+{
+#if defined(TINYRENDERER_SSE)
+    const __m128 vec = _mm_set_ss(value), est = _mm_rsqrt_ss(vec);
+    const __m128 refined = _mm_mul_ss(
+        est,
+        _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(_mm_mul_ss(_mm_set_ss(.5f), vec), _mm_mul_ss(est, est))));
+    return _mm_cvtss_f32(refined);
+#else
+    return 1.f / std::sqrt(value);
+#endif
+}
+
+#endif
@@ -1,5 +1,5 @@
 #include <algorithm>
-#include <stdexcept>
+#include <cassert>
 
 #include "math/triangle.hpp"
 
@@ -25,30 +25,12 @@ float Triangle::scale_barycentric(size_t component_idx, const FloatVector &baryc
 
 const FloatVector &Triangle::at(size_t idx) const
 {
-    switch (idx)
-    {
-    case 0:
-        return p0;
-    case 1:
-        return p1;
-    case 2:
-        return p2;
-    default:
-        throw std::runtime_error("Invalid triangle vertex index");
-    }
+    assert(idx < 3 && "Invalid triangle vertex index");
+    return this->*vertices[idx];
 }
 
 FloatVector &Triangle::operator[](size_t idx)
 {
-    switch (idx)
-    {
-    case 0:
-        return p0;
-    case 1:
-        return p1;
-    case 2:
-        return p2;
-    default:
-        throw std::runtime_error("Invalid triangle vertex index");
-    }
+    assert(idx < 3 && "Invalid triangle vertex index");
+    return this->*vertices[idx];
 }
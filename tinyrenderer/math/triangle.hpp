@@ -15,6 +15,9 @@ struct Triangle
     float scale_barycentric(size_t component_idx, const FloatVector &barycentric) const;
     const FloatVector &at(size_t idx) const;
     FloatVector &operator[](size_t idx);
+
+private:
+    static constexpr FloatVector Triangle::*vertices[] = {&Triangle::p0, &Triangle::p1, &Triangle::p2};
 };
 
 #endif
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "memory/allocation_stats.hpp"
+
+thread_local AllocationScope *innermost_allocation_scope = nullptr;
+
+AllocationCounts::AllocationCounts() : n_allocations(0), n_bytes(0) {}
+
+AllocationScope::AllocationScope() : parent(innermost_allocation_scope)
+{
+    innermost_allocation_scope = this;
+}
+
+AllocationScope::~AllocationScope()
+{
+    innermost_allocation_scope = parent;
+    if (parent)
+    {
+        parent->allocation_counts.n_allocations += allocation_counts.n_allocations;
+        parent->allocation_counts.n_bytes += allocation_counts.n_bytes;
+    }
+}
+
+const AllocationCounts &AllocationScope::counts() const
+{
+    return allocation_counts;
+}
+
+void AllocationScope::record(size_t n_bytes)
+{
+    AllocationScope *scope = innermost_allocation_scope;
+    if (scope)
+    {
+        ++scope->allocation_counts.n_allocations;
+        scope->allocation_counts.n_bytes += n_bytes;
+    }
+}
+
+// Replacements of the global allocation functions, the standard library routes the nothrow forms through them
+void *operator new(size_t n_bytes)
+{
+    void *ptr = std::malloc(n_bytes > 0 ? n_bytes : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    AllocationScope::record(n_bytes);
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void *operator new[](size_t n_bytes)
+{
+    return operator new(n_bytes);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// aligned_alloc needs the size to be a multiple of the alignment
+void *operator new(size_t n_bytes, std::align_val_t alignment)
+{
+    const size_t n_aligned = std::max(static_cast<size_t>(alignment), sizeof(void *)),
+                 n_allocated = std::max<size_t>(1, (n_bytes + n_aligned - 1) / n_aligned) * n_aligned;
+    void *ptr = std::aligned_alloc(n_aligned, n_allocated);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    AllocationScope::record(n_bytes);
+    return ptr;
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void *operator new[](size_t n_bytes, std::align_val_t alignment)
+{
+    return operator new(n_bytes, alignment);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
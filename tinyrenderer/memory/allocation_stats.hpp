@@ -0,0 +1,35 @@
+#ifndef __ALLOCATION_STATS_HPP__
+#define __ALLOCATION_STATS_HPP__
+
+#include <cstddef>
+
+struct AllocationCounts
+{
+    size_t n_allocations, n_bytes;
+
+    AllocationCounts();
+};
+
+// Counts the heap allocations the current thread makes while the scope is alive, through a hook on the global
+// operator new. Scopes nest, a finished scope adds its counts to the enclosing one. Every thread has its own
+// innermost scope, so counting never synchronizes threads and allocations of other threads are not counted.
+class AllocationScope
+{
+private:
+    AllocationCounts allocation_counts;
+    AllocationScope *const parent;
+
+public:
+    AllocationScope();
+    ~AllocationScope();
+
+    AllocationScope(const AllocationScope &) = delete;
+    AllocationScope &operator=(const AllocationScope &) = delete;
+
+    const AllocationCounts &counts() const;
+
+    // Called by the hook for the innermost scope of the thread, if there is one
+    static void record(size_t n_bytes);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "memory/frame_arena.hpp"
+
+FrameArena::FrameArena(size_t initial_capacity) : block(initial_capacity > 0 ? new unsigned char[initial_capacity] : nullptr),
+                                                  capacity(initial_capacity),
+                                                  used(0),
+                                                  overflow_bytes(0) {}
+
+void *FrameArena::allocate_bytes(size_t n_bytes, size_t alignment)
+{
+    const size_t offset = (used + alignment - 1) / alignment * alignment;
+    if (offset + n_bytes <= capacity)
+    {
+        used = offset + n_bytes;
+        return block.get() + offset;
+    }
+
+    // new[] aligns for any fundamental type, the alignment only matters inside of the block
+    overflow_blocks.emplace_back(new unsigned char[std::max<size_t>(1, n_bytes)]);
+    overflow_bytes += n_bytes + alignment;
+    return overflow_blocks.back().get();
+}
+
+void FrameArena::reset()
+{
+    if (!overflow_blocks.empty())
+    {
+        capacity = used + overflow_bytes;
+        block.reset(new unsigned char[capacity]);
+        overflow_blocks.clear();
+        overflow_bytes = 0;
+    }
+
+    used = 0;
+}
+
+size_t FrameArena::bytes_reserved() const
+{
+    return capacity + overflow_bytes;
+}
+
+size_t FrameArena::bytes_used() const
+{
+    return used + overflow_bytes;
+}
@@ -0,0 +1,51 @@
+#ifndef __FRAME_ARENA_HPP__
+#define __FRAME_ARENA_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for data that only lives until the end of the frame, everything is released at once by reset().
+// Allocations that do not fit into the block get blocks of their own until the next reset, which grows the block
+// to the peak usage, so a frame that fits into the previous frames never allocates.
+// Not thread-safe: threads take their slices from the arena before they are started.
+class FrameArena
+{
+private:
+    std::unique_ptr<unsigned char[]> block;
+    size_t capacity, used;
+
+    std::vector<std::unique_ptr<unsigned char[]>> overflow_blocks;
+    size_t overflow_bytes;
+
+    void *allocate_bytes(size_t n_bytes, size_t alignment);
+
+public:
+    explicit FrameArena(size_t initial_capacity = 0);
+
+    // Uninitialized storage for n values, only types without constructors and destructors are allowed
+    template <typename T>
+    T *allocate(size_t n)
+    {
+        static_assert(std::is_trivial<T>::value, "Only trivial types can be allocated from the frame arena");
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    // Same, with every value set
+    template <typename T>
+    T *allocate(size_t n, const T &value)
+    {
+        T *values = allocate<T>(n);
+        std::fill(values, values + n, value);
+        return values;
+    }
+
+    void reset();
+
+    size_t bytes_reserved() const;
+    size_t bytes_used() const;
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+#include "math/simd.hpp"
+#include "rendering/compact_mesh.hpp"
+
+const std::uint32_t compact_mesh_magic = 0x48534d54; // "TMSH"
+const std::uint32_t compact_mesh_version = 1;
+const float quantization_steps = 65535.f, normal_steps = 32767.f;
+
+std::uint16_t quantize(float value, float min, float scale)
+{
+    if (scale == 0.f)
+    {
+        return 0;
+    }
+
+    return static_cast<std::uint16_t>(std::min(quantization_steps, std::max(0.f, std::round((value - min) / scale))));
+}
+
+float sign_not_zero(float value)
+{
+    return value >= 0.f ? 1.f : -1.f;
+}
+
+void encode_octahedral(const FloatVector &normal, std::int16_t *encoded)
+{
+    const float l1_norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1_norm == 0.f)
+    {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+
+    float u = normal.x / l1_norm, v = normal.y / l1_norm;
+    if (normal.z < 0.f)
+    {
+        // The lower hemisphere is folded over the diagonals of the square
+        const float folded_u = (1.f - std::abs(v)) * sign_not_zero(u),
+                    folded_v = (1.f - std::abs(u)) * sign_not_zero(v);
+        u = folded_u;
+        v = folded_v;
+    }
+
+    encoded[0] = static_cast<std::int16_t>(std::round(std::min(1.f, std::max(-1.f, u)) * normal_steps));
+    encoded[1] = static_cast<std::int16_t>(std::round(std::min(1.f, std::max(-1.f, v)) * normal_steps));
+}
+
+FloatVector decode_octahedral(const std::int16_t *encoded)
+{
+    FloatVector normal(encoded[0] / normal_steps, encoded[1] / normal_steps, 0.f);
+    normal.z = 1.f - std::abs(normal.x) - std::abs(normal.y);
+
+    const float fold = std::max(-normal.z, 0.f);
+    normal.x -= sign_not_zero(normal.x) * fold;
+    normal.y -= sign_not_zero(normal.y) * fold;
+
+    return normal.fast_normalize();
+}
+
+CompactMesh::CompactMesh() : position_scale(0.f, 0.f, 0.f), uv_scale(0.f, 0.f, 0.f)
+{
+    update_decode_patterns();
+}
+
+CompactMesh::CompactMesh(
+    const std::vector<Triangle> &faces,
+    const std::vector<Triangle> &textures,
+    const std::vector<Triangle> &normals) : CompactMesh()
+{
+    if (faces.empty())
+    {
+        return;
+    }
+
+    // Meshes without texture coordinates or normals get zero ones
+    const bool has_uvs = textures.size() == faces.size(), has_normals = normals.size() == faces.size();
+
+    FloatVector position_max = faces[0].p0, uv_max = has_uvs ? textures[0].p0 : FloatVector();
+    position_min = position_max;
+    uv_min = uv_max;
+    for (size_t face_idx = 0; face_idx < faces.size(); ++face_idx)
+    {
+        for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+        {
+            const FloatVector position = faces[face_idx].at(vertex_idx),
+                              uv = has_uvs ? textures[face_idx].at(vertex_idx) : FloatVector();
+            for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+            {
+                position_min[i] = std::min(position_min[i], position.at(i));
+                position_max[i] = std::max(position_max[i], position.at(i));
+                uv_min[i] = std::min(uv_min[i], uv.at(i));
+                uv_max[i] = std::max(uv_max[i], uv.at(i));
+            }
+        }
+    }
+
+    position_scale = (position_max - position_min) * (1.f / quantization_steps);
+    uv_scale = (uv_max - uv_min) * (1.f / quantization_steps);
+    uv_min.z = uv_scale.z = 0.f; // Texture coordinates are 2D, the third one is dropped
+    update_decode_patterns();
+
+    // Vertices that are equal after quantization are shared between faces
+    std::map<std::array<int, 7>, std::uint32_t> vertex_ids;
+    indices.reserve(faces.size() * 3);
+    for (size_t face_idx = 0; face_idx < faces.size(); ++face_idx)
+    {
+        for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+        {
+            const FloatVector position = faces[face_idx].at(vertex_idx),
+                              uv = has_uvs ? textures[face_idx].at(vertex_idx) : FloatVector();
+
+            PackedVertex vertex;
+            for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+            {
+                vertex.position[i] = quantize(position.at(i), position_min.at(i), position_scale.at(i));
+            }
+
+            vertex.uv[0] = quantize(uv.x, uv_min.x, uv_scale.x);
+            vertex.uv[1] = quantize(uv.y, uv_min.y, uv_scale.y);
+            encode_octahedral(has_normals ? normals[face_idx].at(vertex_idx) : FloatVector(), vertex.normal);
+
+            const std::array<int, 7> key = {
+                vertex.position[0], vertex.position[1], vertex.position[2],
+                vertex.uv[0], vertex.uv[1],
+                vertex.normal[0], vertex.normal[1]};
+            const auto inserted = vertex_ids.emplace(key, static_cast<std::uint32_t>(vertices.size()));
+            if (inserted.second)
+            {
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(inserted.first->second);
+        }
+    }
+
+    vertices.shrink_to_fit();
+}
+
+void CompactMesh::update_decode_patterns()
+{
+    for (size_t i = 0; i < 16; ++i)
+    {
+        position_offsets[i] = i < 9 ? position_min.at(i % 3) : 0.f;
+        position_scales[i] = i < 9 ? position_scale.at(i % 3) : 0.f;
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        uv_offsets[i] = i < 6 ? uv_min.at(i % 2) : 0.f;
+        uv_scales[i] = i < 6 ? uv_scale.at(i % 2) : 0.f;
+    }
+}
+
+size_t CompactMesh::n_faces() const
+{
+    return indices.size() / 3;
+}
+
+size_t CompactMesh::n_vertices() const
+{
+    return vertices.size();
+}
+
+size_t CompactMesh::memory_usage() const
+{
+    return vertices.size() * sizeof(PackedVertex) + indices.size() * sizeof(std::uint32_t);
+}
+
+FloatVector CompactMesh::position(size_t face_idx, size_t vertex_idx) const
+{
+    const PackedVertex &vertex = vertices[indices[face_idx * 3 + vertex_idx]];
+    return FloatVector(
+        position_min.x + vertex.position[0] * position_scale.x,
+        position_min.y + vertex.position[1] * position_scale.y,
+        position_min.z + vertex.position[2] * position_scale.z);
+}
+
+Triangle CompactMesh::positions(size_t face_idx) const
+{
+    // x0 y0 z0 x1 y1 z1 x2 y2 | z2 and padding
+    float values[16] = {};
+    for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+    {
+        const PackedVertex &vertex = vertices[indices[face_idx * 3 + vertex_idx]];
+        for (size_t i = 0; i < 3; ++i)
+        {
+            values[vertex_idx * 3 + i] = vertex.position[i];
+        }
+    }
+
+    (Float8::load(values) * Float8::load(position_scales) + Float8::load(position_offsets)).store(values);
+    (Float8::load(values + 8) * Float8::load(position_scales + 8) + Float8::load(position_offsets + 8)).store(values + 8);
+
+    return Triangle(
+        FloatVector(values[0], values[1], values[2]),
+        FloatVector(values[3], values[4], values[5]),
+        FloatVector(values[6], values[7], values[8]));
+}
+
+Triangle CompactMesh::uvs(size_t face_idx) const
+{
+    float values[8] = {};
+    for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+    {
+        const PackedVertex &vertex = vertices[indices[face_idx * 3 + vertex_idx]];
+        values[vertex_idx * 2] = vertex.uv[0];
+        values[vertex_idx * 2 + 1] = vertex.uv[1];
+    }
+
+    (Float8::load(values) * Float8::load(uv_scales) + Float8::load(uv_offsets)).store(values);
+
+    return Triangle(
+        FloatVector(values[0], values[1]),
+        FloatVector(values[2], values[3]),
+        FloatVector(values[4], values[5]));
+}
+
+Triangle CompactMesh::normals(size_t face_idx) const
+{
+    return Triangle(
+        decode_octahedral(vertices[indices[face_idx * 3]].normal),
+        decode_octahedral(vertices[indices[face_idx * 3 + 1]].normal),
+        decode_octahedral(vertices[indices[face_idx * 3 + 2]].normal));
+}
+
+void CompactMesh::save(std::ostream &stream) const
+{
+    // Native endianness, the format is meant for the machine that produced it
+    write_value(stream, compact_mesh_magic);
+    write_value(stream, compact_mesh_version);
+    write_value(stream, position_min);
+    write_value(stream, position_scale);
+    write_value(stream, uv_min);
+    write_value(stream, uv_scale);
+
+    write_value(stream, static_cast<std::uint64_t>(vertices.size()));
+    stream.write(reinterpret_cast<const char *>(vertices.data()), vertices.size() * sizeof(PackedVertex));
+    write_value(stream, static_cast<std::uint64_t>(indices.size()));
+    stream.write(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(std::uint32_t));
+}
+
+std::uint64_t remaining_stream_bytes(std::istream &stream)
+{
+    const std::streampos position = stream.tellg();
+    if (position < 0 || !stream.seekg(0, std::ios::end))
+    {
+        stream.clear();
+        return std::numeric_limits<std::uint64_t>::max();
+    }
+
+    const std::streampos end = stream.tellg();
+    stream.seekg(position);
+    return end > position ? static_cast<std::uint64_t>(end - position) : 0;
+}
+
+void CompactMesh::load(std::istream &stream)
+{
+    std::uint32_t magic = 0, version = 0;
+    read_value(stream, magic);
+    read_value(stream, version);
+    if (magic != compact_mesh_magic || version != compact_mesh_version)
+    {
+        throw std::runtime_error("Not a compact mesh file");
+    }
+
+    read_value(stream, position_min);
+    read_value(stream, position_scale);
+    read_value(stream, uv_min);
+    read_value(stream, uv_scale);
+    update_decode_patterns();
+
+    // The counts are checked against the rest of the file before anything is allocated for them
+    std::uint64_t n_packed = 0;
+    read_value(stream, n_packed);
+    if (stream.fail() || n_packed > remaining_stream_bytes(stream) / sizeof(PackedVertex))
+    {
+        throw std::runtime_error("Corrupt compact mesh file");
+    }
+
+    vertices.resize(n_packed);
+    stream.read(reinterpret_cast<char *>(vertices.data()), n_packed * sizeof(PackedVertex));
+
+    read_value(stream, n_packed);
+    if (stream.fail() || n_packed % 3 != 0 || n_packed > remaining_stream_bytes(stream) / sizeof(std::uint32_t))
+    {
+        throw std::runtime_error("Corrupt compact mesh file");
+    }
+
+    indices.resize(n_packed);
+    stream.read(reinterpret_cast<char *>(indices.data()), n_packed * sizeof(std::uint32_t));
+
+    if (stream.fail())
+    {
+        throw std::runtime_error("Truncated compact mesh file");
+    }
+
+    for (const std::uint32_t idx : indices)
+    {
+        if (idx >= vertices.size())
+        {
+            throw std::runtime_error("Invalid vertex index in compact mesh file");
+        }
+    }
+}
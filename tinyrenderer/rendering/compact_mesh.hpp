@@ -0,0 +1,70 @@
+#ifndef __COMPACT_MESH_HPP__
+#define __COMPACT_MESH_HPP__
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "math/linalg.hpp"
+#include "math/triangle.hpp"
+
+// Bytes between the read position and the end of the stream, the maximum for streams that cannot seek
+std::uint64_t remaining_stream_bytes(std::istream &stream);
+
+// Fixed-size fields of the binary formats, in native endianness
+template <typename T>
+void write_value(std::ostream &stream, const T &value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void read_value(std::istream &stream, T &value)
+{
+    stream.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+// 14 bytes per vertex: positions and UVs are quantized against the mesh bounds,
+// normals are octahedral-encoded
+struct PackedVertex
+{
+    std::uint16_t position[3];
+    std::uint16_t uv[2];
+    std::int16_t normal[2];
+};
+
+// Indexed mesh built out of packed vertices, faces are decoded on demand
+class CompactMesh
+{
+private:
+    FloatVector position_min, position_scale, uv_min, uv_scale;
+    std::vector<PackedVertex> vertices;
+    std::vector<std::uint32_t> indices;
+
+    // Quantization scales repeated over the lanes, so that a whole face is decoded by a few Float8 operations
+    float position_offsets[16], position_scales[16], uv_offsets[8], uv_scales[8];
+
+    void update_decode_patterns();
+
+public:
+    CompactMesh();
+    CompactMesh(
+        const std::vector<Triangle> &faces,
+        const std::vector<Triangle> &textures,
+        const std::vector<Triangle> &normals);
+
+    size_t n_faces() const;
+    size_t n_vertices() const;
+    size_t memory_usage() const;
+
+    FloatVector position(size_t face_idx, size_t vertex_idx) const;
+    Triangle positions(size_t face_idx) const;
+    Triangle uvs(size_t face_idx) const;
+    Triangle normals(size_t face_idx) const;
+
+    void save(std::ostream &stream) const;
+    void load(std::istream &stream);
+};
+
+#endif
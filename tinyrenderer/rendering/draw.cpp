@@ -5,22 +5,143 @@
 
 #include "rendering/draw.hpp"
 
-FloatVector barycentric_coords(const FloatVector &p, const Triangle &triangle)
+FloatVector8 barycentric_coords(const FloatVector8 &p, const Triangle &triangle)
 {
     const FloatVector p10 = triangle.p1 - triangle.p0,
-                      p20 = triangle.p2 - triangle.p0,
-                      p0p = triangle.p0 - p;
+                      p20 = triangle.p2 - triangle.p0;
+    const FloatVector8 p0p = FloatVector8(triangle.p0) - p;
 
-    const FloatVector top_row(p10.x, p20.x, p0p.x),
+    const FloatVector8 top_row(p10.x, p20.x, p0p.x),
         bottom_row(p10.y, p20.y, p0p.y);
-    const FloatVector cross = top_row ^ bottom_row;
-    if (std::abs(cross.z) < 1)
+    const FloatVector8 cross = top_row ^ bottom_row;
+
+    return FloatVector8(
+        Float8(1.f) - (cross.x + cross.y) / cross.z, cross.x / cross.z, cross.y / cross.z);
+}
+
+VaryingPlanes::VaryingPlanes(const Triangle &triangle, const Shader &shader) : n_varyings(shader.varying_count()),
+                                                                              origin_x(triangle.p0.x),
+                                                                              origin_y(triangle.p0.y)
+{
+    const FloatVector p10 = triangle.p1 - triangle.p0,
+                      p20 = triangle.p2 - triangle.p0;
+    const float area = p10.x * p20.y - p10.y * p20.x,
+                inverse_area = area != 0.f ? 1.f / area : 0.f;
+
+    for (size_t plane = 0; plane <= n_varyings; ++plane)
+    {
+        float values[3];
+        for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+        {
+            const float inverse_w = shader.vertex_inverse_w(vertex_idx);
+            values[vertex_idx] = plane < n_varyings ? shader.vertex_varyings(vertex_idx)[plane] * inverse_w : inverse_w;
+        }
+
+        const float delta_1 = values[1] - values[0], delta_2 = values[2] - values[0];
+        origin_values[plane] = values[0];
+        x_steps[plane] = (delta_1 * p20.y - delta_2 * p10.y) * inverse_area;
+        y_steps[plane] = (delta_2 * p10.x - delta_1 * p20.x) * inverse_area;
+    }
+}
+
+void VaryingPlanes::evaluate(int x, int y, float (*varyings)[Float8::size]) const
+{
+    // Along the column every plane only needs one multiply-add per eight pixels
+    const float column_offset = x - origin_x;
+    const Float8 row_offsets = Float8::ramp(y, 1.f) - Float8(origin_y);
+
+    const Float8 w = Float8(1.f) / (Float8(origin_values[n_varyings] + x_steps[n_varyings] * column_offset) +
+                                    row_offsets * Float8(y_steps[n_varyings]));
+    for (size_t plane = 0; plane < n_varyings; ++plane)
     {
-        return FloatVector(-1.f, 1.f, 1.f);
+        const Float8 divided = Float8(origin_values[plane] + x_steps[plane] * column_offset) +
+                               row_offsets * Float8(y_steps[plane]);
+        (divided * w).store(varyings[plane]);
     }
+}
+
+void VaryingPlanes::evaluate(int x, int y, float *varyings) const
+{
+    float lanes[max_varyings][Float8::size];
+    evaluate(x, y, lanes);
+    for (size_t plane = 0; plane < n_varyings; ++plane)
+    {
+        varyings[plane] = lanes[plane][0];
+    }
+}
+
+// Calls begin_block(x, y) once for every block of eight pixels of a column with covered pixels, then
+// handle_fragment(x, y, lane) for the covered pixels of the block passing the depth test.
+// The depth is written unless the handler discards the fragment by returning true.
+template <typename BlockHandler, typename FragmentHandler>
+void rasterize_triangle(
+    const Triangle &triangle,
+    int screen_width,
+    int screen_height,
+    std::vector<std::vector<float>> &zbuf,
+    BlockHandler &begin_block,
+    FragmentHandler &handle_fragment)
+{
+    // The z component of the barycentric cross product does not depend on the pixel,
+    // so degenerate triangles are rejected once instead of at every pixel
+    const FloatVector p10 = triangle.p1 - triangle.p0,
+                      p20 = triangle.p2 - triangle.p0;
+    if (std::abs(p10.x * p20.y - p10.y * p20.x) < 1)
+    {
+        return;
+    }
+
+    const auto bbox = triangle.bounding_box(screen_width, screen_height);
+    const int lanes = Float8::size;
+
+    float barycentric_x[lanes], barycentric_y[lanes], barycentric_z[lanes];
+    for (int x = bbox.first.x; x <= bbox.second.x; ++x)
+    {
+        // Eight pixels of a column are tested at once
+        for (int y = bbox.first.y; y <= bbox.second.y; y += lanes)
+        {
+            const FloatVector8 pixels(static_cast<float>(x), Float8::ramp(y, 1.f), 0.f);
+            const FloatVector8 barycentric = barycentric_coords(pixels, triangle);
+
+            const int lanes_in_bbox = std::min(lanes, bbox.second.y - y + 1);
+            const int covered = ~(barycentric.x.negative_mask() |
+                                  barycentric.y.negative_mask() |
+                                  barycentric.z.negative_mask()) &
+                                ((1 << lanes_in_bbox) - 1);
+            if (covered == 0)
+            {
+                continue;
+            }
+
+            begin_block(x, y);
 
-    return FloatVector(
-        1 - (cross.x + cross.y) / cross.z, cross.x / cross.z, cross.y / cross.z);
+            barycentric.x.store(barycentric_x);
+            barycentric.y.store(barycentric_y);
+            barycentric.z.store(barycentric_z);
+            for (int lane = 0; lane < lanes_in_bbox; ++lane)
+            {
+                if (!(covered & (1 << lane)))
+                {
+                    continue;
+                }
+
+                const int pixel_y = y + lane;
+                const FloatVector pixel_barycentric(barycentric_x[lane], barycentric_y[lane], barycentric_z[lane]);
+                const float pixel_z = triangle.scale_barycentric(VectorComponent::Z, pixel_barycentric);
+                if (pixel_z < zbuf[x][pixel_y])
+                {
+                    continue;
+                }
+
+                if (handle_fragment(x, pixel_y, lane))
+                {
+                    continue;
+                }
+
+                zbuf[x][pixel_y] = pixel_z;
+            }
+        }
+    }
 }
 
 void draw_triangle(
@@ -29,37 +150,146 @@ void draw_triangle(
     std::vector<std::vector<float>> &zbuf,
     Shader &shader)
 {
+    const VaryingPlanes planes(triangle, shader);
+    const size_t n_varyings = shader.varying_count();
+
+    float block_varyings[max_varyings][Float8::size];
+    auto interpolate_block = [&planes, &block_varyings](int x, int y)
+    {
+        planes.evaluate(x, y, block_varyings);
+    };
+
+    auto shade_fragment = [&screen, &shader, &block_varyings, n_varyings](int x, int y, int lane)
+    {
+        float varyings[max_varyings];
+        for (size_t varying_idx = 0; varying_idx < n_varyings; ++varying_idx)
+        {
+            varyings[varying_idx] = block_varyings[varying_idx][lane];
+        }
+
+        sf::Color color = sf::Color::Black;
+        if (shader.fragment(x, y, varyings, color))
+        {
+            return true;
+        }
+
+        screen.setPixel(x, y, color);
+        return false;
+    };
+
     const auto screen_size = screen.getSize();
-    const auto bbox = triangle.bounding_box(screen_size.x, screen_size.y);
-    for (int x = bbox.first.x; x <= bbox.second.x; ++x)
+    rasterize_triangle(triangle, screen_size.x, screen_size.y, zbuf, interpolate_block, shade_fragment);
+}
+
+void draw_triangle_visibility(
+    const Triangle &triangle,
+    int face_idx,
+    std::vector<std::vector<float>> &zbuf,
+    int *face_ids)
+{
+    const int screen_width = zbuf.size(), screen_height = zbuf.empty() ? 0 : zbuf[0].size();
+
+    auto skip_block = [](int, int) {};
+    auto write_face_id = [face_ids, face_idx, screen_height](int x, int y, int)
     {
-        for (int y = bbox.first.y; y <= bbox.second.y; ++y)
+        face_ids[static_cast<size_t>(x) * screen_height + y] = face_idx;
+        return false;
+    };
+
+    rasterize_triangle(triangle, screen_width, screen_height, zbuf, skip_block, write_face_id);
+}
+
+void draw_model(
+    sf::Image &screen,
+    const Model &model,
+    std::vector<std::vector<float>> &zbuf,
+    Shader &shader,
+    const FloatVector &eye,
+    FrameArena &arena)
+{
+    const size_t *cluster_order = sort_clusters_front_to_back(model.clusters, eye, arena);
+    for (size_t i = 0; i < model.clusters.size(); ++i)
+    {
+        const FaceCluster &cluster = model.clusters[cluster_order[i]];
+        for (size_t face_idx = cluster.first_face; face_idx < cluster.first_face + cluster.n_faces; ++face_idx)
         {
-            FloatVector pixel(x, y, 0.);
-            const FloatVector barycentric = barycentric_coords(pixel, triangle);
-            if (barycentric.x < 0 || barycentric.y < 0 || barycentric.z < 0)
+            Triangle screen_coords;
+            shader.begin_face(face_idx);
+            for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
             {
-                continue;
+                screen_coords[vertex_idx] = shader.vertex(face_idx, vertex_idx);
             }
 
-            pixel.z = triangle.scale_barycentric(VectorComponent::Z, barycentric);
-            if (pixel.z < zbuf[x][y])
+            draw_triangle(screen, screen_coords, zbuf, shader);
+        }
+    }
+}
+
+// Bresenham with separate x-major and y-major loops, the pixel writer gets the interpolated depth
+template <typename PixelWriter>
+void rasterize_line(int x0, int y0, float z0, int x1, int y1, float z1, PixelWriter &write_pixel)
+{
+    if (std::abs(x1 - x0) >= std::abs(y1 - y0))
+    {
+        if (x1 < x0)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            std::swap(z0, z1);
+        }
+
+        const int dx = x1 - x0, err_plus_delta = 2 * std::abs(y1 - y0), err_minus_delta = 2 * dx,
+                  y_step = y1 > y0 ? 1 : -1;
+        const float z_step = dx > 0 ? (z1 - z0) / dx : 0.f;
+
+        int two_error = 0, y = y0;
+        float z = z0;
+        for (int x = x0; x <= x1; ++x, z += z_step)
+        {
+            write_pixel(x, y, z);
+
+            two_error += err_plus_delta;
+            if (two_error > dx)
             {
-                continue;
+                y += y_step;
+                two_error -= err_minus_delta;
             }
+        }
+    }
+    else
+    {
+        if (y1 < y0)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            std::swap(z0, z1);
+        }
+
+        const int dy = y1 - y0, err_plus_delta = 2 * std::abs(x1 - x0), err_minus_delta = 2 * dy,
+                  x_step = x1 > x0 ? 1 : -1;
+        const float z_step = dy > 0 ? (z1 - z0) / dy : 0.f;
 
-            sf::Color color = sf::Color::Black;
-            if (shader.fragment(barycentric, color))
+        int two_error = 0, x = x0;
+        float z = z0;
+        for (int y = y0; y <= y1; ++y, z += z_step)
+        {
+            write_pixel(x, y, z);
+
+            two_error += err_plus_delta;
+            if (two_error > dy)
             {
-                continue;
+                x += x_step;
+                two_error -= err_minus_delta;
             }
-
-            zbuf[x][y] = pixel.z;
-            screen.setPixel(x, y, color);
         }
     }
 }
 
+bool clip_to_screen(LineSegment &segment, const sf::Vector2u &screen_size)
+{
+    return segment.clip(0.f, 0.f, screen_size.x - 1.f, screen_size.y - 1.f);
+}
+
 void draw_line(
     sf::Image &screen,
     int x0,
@@ -68,38 +298,86 @@ void draw_line(
     int y1,
     const sf::Color &color)
 {
-    bool transpose = false;
-    if (std::abs(x1 - x0) < std::abs(y1 - y0))
+    LineSegment segment(FloatVector(x0, y0), FloatVector(x1, y1));
+    if (!clip_to_screen(segment, screen.getSize()))
     {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-        transpose = true;
+        return;
     }
 
-    if (x1 < x0)
-    {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
-    }
+    auto write_pixel = [&screen, &color](int x, int y, float)
+    { screen.setPixel(x, y, color); };
+    rasterize_line(
+        std::lround(segment.p0.x),
+        std::lround(segment.p0.y),
+        0.f,
+        std::lround(segment.p1.x),
+        std::lround(segment.p1.y),
+        0.f,
+        write_pixel);
+}
 
-    const int dy = y1 - y0, dx = x1 - x0;
-    int two_error = 0, y = y0, err_plus_delta = 2 * std::abs(dy), err_minus_delta = 2 * dx;
-    for (int x = x0; x <= x1; ++x)
+template <typename DepthTest>
+void draw_lines(
+    sf::Image &screen,
+    const std::vector<LineSegment> &segments,
+    const sf::Color &color,
+    const DepthTest &depth_test)
+{
+    // sf::Image has no mutable access to its pixels, so the whole batch is drawn into a copy
+    const auto screen_size = screen.getSize();
+    const sf::Uint8 *screen_pixels = screen.getPixelsPtr();
+    std::vector<sf::Uint8> pixels(screen_pixels, screen_pixels + screen_size.x * screen_size.y * 4);
+
+    auto write_pixel = [&pixels, &color, &depth_test, &screen_size](int x, int y, float z)
     {
-        if (transpose)
+        if (!depth_test(x, y, z))
         {
-            screen.setPixel(y, x, color);
-        }
-        else
-        {
-            screen.setPixel(x, y, color);
+            return;
         }
 
-        two_error += err_plus_delta;
-        if (two_error > dx)
+        sf::Uint8 *pixel = &pixels[(static_cast<size_t>(y) * screen_size.x + x) * 4];
+        pixel[0] = color.r;
+        pixel[1] = color.g;
+        pixel[2] = color.b;
+        pixel[3] = color.a;
+    };
+
+    for (LineSegment segment : segments)
+    {
+        if (!clip_to_screen(segment, screen_size))
         {
-            y += y1 > y0 ? 1 : -1;
-            two_error -= err_minus_delta;
+            continue;
         }
+
+        rasterize_line(
+            std::lround(segment.p0.x),
+            std::lround(segment.p0.y),
+            segment.p0.z,
+            std::lround(segment.p1.x),
+            std::lround(segment.p1.y),
+            segment.p1.z,
+            write_pixel);
     }
+
+    screen.create(screen_size.x, screen_size.y, pixels.data());
+}
+
+void draw_lines(
+    sf::Image &screen,
+    const std::vector<LineSegment> &segments,
+    const sf::Color &color)
+{
+    draw_lines(screen, segments, color, [](int, int, float)
+               { return true; });
+}
+
+void draw_lines(
+    sf::Image &screen,
+    const std::vector<LineSegment> &segments,
+    const sf::Color &color,
+    const std::vector<std::vector<float>> &zbuf,
+    float depth_bias)
+{
+    draw_lines(screen, segments, color, [&zbuf, depth_bias](int x, int y, float z)
+               { return z + depth_bias >= zbuf[x][y]; });
 }
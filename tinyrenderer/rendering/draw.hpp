@@ -6,15 +6,57 @@
 #include <SFML/Graphics.hpp>
 
 #include "math/linalg.hpp"
+#include "math/segment.hpp"
 #include "math/triangle.hpp"
+#include "memory/frame_arena.hpp"
+#include "rendering/model.hpp"
 #include "rendering/shader.hpp"
 
+// Plane equations over the screen of the shader's varyings divided by w and of 1/w itself,
+// set up once per triangle from the outputs of the last three vertex calls
+class VaryingPlanes
+{
+private:
+    const size_t n_varyings;
+    const float origin_x, origin_y;
+
+    // The last plane is 1/w
+    float origin_values[max_varyings + 1], x_steps[max_varyings + 1], y_steps[max_varyings + 1];
+
+public:
+    VaryingPlanes(const Triangle &triangle, const Shader &shader);
+
+    // Perspective correct varyings of the eight pixels of column x starting at y, one row of lanes per varying
+    void evaluate(int x, int y, float (*varyings)[Float8::size]) const;
+
+    // The varyings of one pixel, equal to the ones evaluate gives for its lane
+    void evaluate(int x, int y, float *varyings) const;
+};
+
 void draw_triangle(
     sf::Image &screen,
     const Triangle &triangle,
     std::vector<std::vector<float>> &zbuf,
     Shader &shader);
 
+// Depth tested like draw_triangle, but only the index of the face is written, for deferred shading.
+// The face ids are stored column after column, like the z-buffer.
+void draw_triangle_visibility(
+    const Triangle &triangle,
+    int face_idx,
+    std::vector<std::vector<float>> &zbuf,
+    int *face_ids);
+
+// Draws the model cluster by cluster, front to back as seen from the eye (given in model space).
+// The cluster order is allocated from the arena.
+void draw_model(
+    sf::Image &screen,
+    const Model &model,
+    std::vector<std::vector<float>> &zbuf,
+    Shader &shader,
+    const FloatVector &eye,
+    FrameArena &arena);
+
 void draw_line(
     sf::Image &screen,
     int x0,
@@ -23,4 +65,18 @@ void draw_line(
     int y1,
     const sf::Color &color);
 
+// Draws a batch of screen space segments, clipping them to the screen
+void draw_lines(
+    sf::Image &screen,
+    const std::vector<LineSegment> &segments,
+    const sf::Color &color);
+
+// Same, but only the pixels passing the z-buffer test are drawn. The z-buffer is not updated.
+void draw_lines(
+    sf::Image &screen,
+    const std::vector<LineSegment> &segments,
+    const sf::Color &color,
+    const std::vector<std::vector<float>> &zbuf,
+    float depth_bias = 1.f);
+
 #endif
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "rendering/lighting.hpp"
+
+Light::Light() : type(LightType::DIRECTIONAL),
+                 color(1.f, 1.f, 1.f),
+                 intensity(1.f),
+                 radius(0.f),
+                 cos_inner(1.f),
+                 cos_outer(1.f) {}
+
+Light Light::directional(const FloatVector &direction, const FloatVector &color, float intensity)
+{
+    Light light;
+    light.type = LightType::DIRECTIONAL;
+    light.direction = direction.normalize();
+    light.color = color;
+    light.intensity = intensity;
+    return light;
+}
+
+Light Light::point(const FloatVector &position, const FloatVector &color, float intensity, float radius)
+{
+    Light light;
+    light.type = LightType::POINT;
+    light.position = position;
+    light.color = color;
+    light.intensity = intensity;
+    light.radius = radius;
+    return light;
+}
+
+Light Light::spot(
+    const FloatVector &position,
+    const FloatVector &direction,
+    const FloatVector &color,
+    float intensity,
+    float radius,
+    float inner_angle,
+    float outer_angle)
+{
+    Light light = Light::point(position, color, intensity, radius);
+    light.type = LightType::SPOT;
+    light.direction = direction.normalize();
+    light.cos_inner = std::cos(inner_angle);
+    light.cos_outer = std::cos(outer_angle);
+    return light;
+}
+
+FloatVector Light::incident(const FloatVector &point, float &attenuation) const
+{
+    if (type == LightType::DIRECTIONAL)
+    {
+        attenuation = intensity;
+        return direction;
+    }
+
+    const FloatVector to_light = position - point;
+    const float distance_sq = to_light * to_light, radius_sq = radius * radius;
+    if (distance_sq >= radius_sq || distance_sq == 0.f)
+    {
+        attenuation = 0.f;
+        return to_light;
+    }
+
+    // Windowed inverse square falloff, reaches zero exactly at the radius
+    const float window = 1.f - distance_sq / radius_sq;
+    attenuation = intensity * window * window / (1.f + distance_sq);
+
+    const FloatVector incident_dir = to_light.fast_normalize();
+    if (type == LightType::SPOT)
+    {
+        const float cos_angle = -(incident_dir * direction);
+        const float t = std::min(1.f, std::max(0.f, (cos_angle - cos_outer) / std::max(1e-4f, cos_inner - cos_outer)));
+        attenuation *= t * t * (3.f - 2.f * t);
+    }
+
+    return incident_dir;
+}
+
+LightingStats::LightingStats() : n_lights(0),
+                                 n_global_lights(0),
+                                 n_tiles(0),
+                                 n_occupied_tiles(0),
+                                 total_tile_lights(0),
+                                 max_tile_lights(0) {}
+
+float LightingStats::mean_tile_lights() const
+{
+    return n_occupied_tiles == 0 ? 0.f : static_cast<float>(total_tile_lights) / n_occupied_tiles;
+}
+
+const size_t *LightRange::begin() const
+{
+    return first;
+}
+
+const size_t *LightRange::end() const
+{
+    return last;
+}
+
+size_t LightRange::size() const
+{
+    return last - first;
+}
+
+LightGrid::LightGrid(int screen_width, int screen_height, int tile_size) : tile_size(tile_size),
+                                                                           tiles_x((screen_width + tile_size - 1) / tile_size),
+                                                                           tiles_y((screen_height + tile_size - 1) / tile_size),
+                                                                           tile_offsets(tiles_x * tiles_y + 1, 0),
+                                                                           tile_min_depth(tiles_x * tiles_y),
+                                                                           tile_max_depth(tiles_x * tiles_y) {}
+
+void LightGrid::compute_tile_depths(const std::vector<std::vector<float>> &zbuf)
+{
+    // Tiles without any geometry end up with an empty range and never get lights
+    std::fill(tile_min_depth.begin(), tile_min_depth.end(), std::numeric_limits<float>::max());
+    std::fill(tile_max_depth.begin(), tile_max_depth.end(), -std::numeric_limits<float>::max());
+
+    const float empty = -std::numeric_limits<float>::max();
+    for (size_t x = 0; x < zbuf.size(); ++x)
+    {
+        const size_t tile_x = x / tile_size;
+        for (size_t y = 0; y < zbuf[x].size(); ++y)
+        {
+            const float depth = zbuf[x][y];
+            if (depth == empty)
+            {
+                continue;
+            }
+
+            const size_t tile_idx = y / tile_size * tiles_x + tile_x;
+            tile_min_depth[tile_idx] = std::min(tile_min_depth[tile_idx], depth);
+            tile_max_depth[tile_idx] = std::max(tile_max_depth[tile_idx], depth);
+        }
+    }
+}
+
+void LightGrid::build(
+    const std::vector<Light> &lights,
+    const Matrix &world_to_screen,
+    const std::vector<std::vector<float>> &zbuf)
+{
+    compute_tile_depths(zbuf);
+
+    global_lights.clear();
+    std::fill(tile_offsets.begin(), tile_offsets.end(), 0);
+
+    // Screen space bounds of every local light: tile rectangle and depth range
+    std::vector<size_t> local_lights;
+    std::vector<IntVector> tile_from, tile_to;
+    std::vector<float> min_depths, max_depths;
+    for (size_t light_idx = 0; light_idx < lights.size(); ++light_idx)
+    {
+        const Light &light = lights[light_idx];
+        if (light.type == LightType::DIRECTIONAL)
+        {
+            global_lights.push_back(light_idx);
+            continue;
+        }
+
+        // The projected corners of the bounding box of the light sphere bound its projection
+        float min_x = std::numeric_limits<float>::max(), max_x = -min_x,
+              min_y = min_x, max_y = -min_x,
+              min_z = min_x, max_z = -min_x;
+        bool behind_camera = false;
+        for (size_t corner = 0; corner < 8; ++corner)
+        {
+            const FloatVector offset(
+                corner & 1 ? light.radius : -light.radius,
+                corner & 2 ? light.radius : -light.radius,
+                corner & 4 ? light.radius : -light.radius);
+            const Matrix projected = world_to_screen * Matrix(light.position + offset);
+            const float w = projected.at(VectorComponent::W)[0];
+            if (w <= 0.f)
+            {
+                behind_camera = true;
+                break;
+            }
+
+            const FloatVector screen = projected.to_vector();
+            min_x = std::min(min_x, screen.x);
+            max_x = std::max(max_x, screen.x);
+            min_y = std::min(min_y, screen.y);
+            max_y = std::max(max_y, screen.y);
+            min_z = std::min(min_z, screen.z);
+            max_z = std::max(max_z, screen.z);
+        }
+
+        IntVector from(0, 0), to(tiles_x - 1, tiles_y - 1);
+        if (behind_camera)
+        {
+            min_z = -std::numeric_limits<float>::max();
+            max_z = std::numeric_limits<float>::max();
+        }
+        else
+        {
+            // Clamped as floats first, the bounds can be far outside the screen
+            const float last_tile_x = tiles_x - 1, last_tile_y = tiles_y - 1;
+            from = IntVector(
+                std::max(0.f, std::min(last_tile_x + 1, std::floor(min_x / tile_size))),
+                std::max(0.f, std::min(last_tile_y + 1, std::floor(min_y / tile_size))));
+            to = IntVector(
+                std::min(last_tile_x, std::max(-1.f, std::floor(max_x / tile_size))),
+                std::min(last_tile_y, std::max(-1.f, std::floor(max_y / tile_size))));
+        }
+
+        if (from.x > to.x || from.y > to.y)
+        {
+            continue;
+        }
+
+        local_lights.push_back(light_idx);
+        tile_from.push_back(from);
+        tile_to.push_back(to);
+        min_depths.push_back(min_z);
+        max_depths.push_back(max_z);
+    }
+
+    // Counting pass, then the light indices are scattered into one array
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        std::vector<size_t> fill_pos;
+        if (pass == 1)
+        {
+            for (size_t tile_idx = 0; tile_idx < tile_min_depth.size(); ++tile_idx)
+            {
+                tile_offsets[tile_idx + 1] += tile_offsets[tile_idx];
+            }
+
+            tile_light_indices.resize(tile_offsets.back());
+            fill_pos.assign(tile_offsets.begin(), tile_offsets.end() - 1);
+        }
+
+        for (size_t i = 0; i < local_lights.size(); ++i)
+        {
+            for (int tile_y = tile_from[i].y; tile_y <= tile_to[i].y; ++tile_y)
+            {
+                for (int tile_x = tile_from[i].x; tile_x <= tile_to[i].x; ++tile_x)
+                {
+                    const size_t tile_idx = tile_y * tiles_x + tile_x;
+                    if (max_depths[i] < tile_min_depth[tile_idx] || min_depths[i] > tile_max_depth[tile_idx])
+                    {
+                        continue;
+                    }
+
+                    if (pass == 0)
+                    {
+                        ++tile_offsets[tile_idx + 1];
+                    }
+                    else
+                    {
+                        tile_light_indices[fill_pos[tile_idx]++] = local_lights[i];
+                    }
+                }
+            }
+        }
+    }
+
+    last_stats = LightingStats();
+    last_stats.n_lights = lights.size();
+    last_stats.n_global_lights = global_lights.size();
+    last_stats.n_tiles = tile_min_depth.size();
+    for (size_t tile_idx = 0; tile_idx < tile_min_depth.size(); ++tile_idx)
+    {
+        if (tile_min_depth[tile_idx] > tile_max_depth[tile_idx])
+        {
+            continue;
+        }
+
+        const size_t n_tile_lights = tile_offsets[tile_idx + 1] - tile_offsets[tile_idx] + global_lights.size();
+        ++last_stats.n_occupied_tiles;
+        last_stats.total_tile_lights += n_tile_lights;
+        last_stats.max_tile_lights = std::max(last_stats.max_tile_lights, n_tile_lights);
+    }
+}
+
+LightRange LightGrid::global() const
+{
+    return LightRange{global_lights.data(), global_lights.data() + global_lights.size()};
+}
+
+LightRange LightGrid::tile(int pixel_x, int pixel_y) const
+{
+    const int tile_x = std::min(tiles_x - 1, std::max(0, pixel_x / tile_size)),
+              tile_y = std::min(tiles_y - 1, std::max(0, pixel_y / tile_size));
+    const size_t tile_idx = tile_y * tiles_x + tile_x;
+    return LightRange{
+        tile_light_indices.data() + tile_offsets[tile_idx],
+        tile_light_indices.data() + tile_offsets[tile_idx + 1]};
+}
+
+const LightingStats &LightGrid::stats() const
+{
+    return last_stats;
+}
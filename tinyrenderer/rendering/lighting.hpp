@@ -0,0 +1,86 @@
+#ifndef __LIGHTING_HPP__
+#define __LIGHTING_HPP__
+
+#include <vector>
+
+#include "math/linalg.hpp"
+
+enum LightType
+{
+    DIRECTIONAL,
+    POINT,
+    SPOT
+};
+
+struct Light
+{
+    LightType type;
+
+    // Directional lights only use the direction, which points towards the light like the shader light vector.
+    // Spot lights shine along the direction, within the cone given by the cosines of its half-angles.
+    FloatVector position, direction, color;
+    float intensity, radius, cos_inner, cos_outer;
+
+    Light();
+
+    static Light directional(const FloatVector &direction, const FloatVector &color, float intensity);
+    static Light point(const FloatVector &position, const FloatVector &color, float intensity, float radius);
+    static Light spot(
+        const FloatVector &position,
+        const FloatVector &direction,
+        const FloatVector &color,
+        float intensity,
+        float radius,
+        float inner_angle,
+        float outer_angle);
+
+    // Returns the direction from the point towards the light, the attenuation is written into the second argument
+    FloatVector incident(const FloatVector &point, float &attenuation) const;
+};
+
+struct LightingStats
+{
+    size_t n_lights, n_global_lights, n_tiles, n_occupied_tiles, total_tile_lights, max_tile_lights;
+
+    LightingStats();
+    float mean_tile_lights() const;
+};
+
+struct LightRange
+{
+    const size_t *first, *last;
+
+    const size_t *begin() const;
+    const size_t *end() const;
+    size_t size() const;
+};
+
+// Bins the lights into screen tiles for forward+ shading
+class LightGrid
+{
+private:
+    const int tile_size, tiles_x, tiles_y;
+
+    std::vector<size_t> global_lights, tile_offsets, tile_light_indices;
+    std::vector<float> tile_min_depth, tile_max_depth;
+    LightingStats last_stats;
+
+    void compute_tile_depths(const std::vector<std::vector<float>> &zbuf);
+
+public:
+    LightGrid(int screen_width, int screen_height, int tile_size = 16);
+
+    // Lights are given in world space and projected with viewport * projection * view.
+    // The tile depth ranges are taken from the z-buffer, so it should hold a depth pre-pass.
+    void build(
+        const std::vector<Light> &lights,
+        const Matrix &world_to_screen,
+        const std::vector<std::vector<float>> &zbuf);
+
+    // Directional lights, which affect every tile
+    LightRange global() const;
+    LightRange tile(int pixel_x, int pixel_y) const;
+    const LightingStats &stats() const;
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "rendering/mesh_optimizer.hpp"
+
+FaceCluster::FaceCluster() : first_face(0), n_faces(0) {}
+
+FaceCluster::FaceCluster(size_t first_face, size_t n_faces) : first_face(first_face), n_faces(n_faces) {}
+
+float vertex_cache_score(int cache_pos, size_t remaining_faces, size_t cache_size)
+{
+    if (remaining_faces == 0)
+    {
+        return -1.f;
+    }
+
+    float score = 0.f;
+    if (cache_pos >= 0)
+    {
+        // The last triangle's vertices get a fixed score so that strips don't get preferred too much
+        if (cache_pos < 3)
+        {
+            score = .75f;
+        }
+        else
+        {
+            score = std::pow(1.f - static_cast<float>(cache_pos - 3) / (cache_size - 3), 1.5f);
+        }
+    }
+
+    // Vertices with few remaining faces are boosted to get rid of them quickly
+    return score + 2.f / std::sqrt(static_cast<float>(remaining_faces));
+}
+
+std::vector<size_t> optimize_vertex_cache(
+    const std::vector<IntVector> &face_indices,
+    size_t n_vertices,
+    size_t cache_size)
+{
+    const size_t n_faces = face_indices.size(), no_face = std::numeric_limits<size_t>::max();
+
+    // Vertex -> adjacent faces, the still unadded faces are kept at the front of each range
+    std::vector<size_t> adjacency_offsets(n_vertices + 1, 0), adjacency(n_faces * 3);
+    for (const auto &face : face_indices)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            ++adjacency_offsets[face.at(k) + 1];
+        }
+    }
+
+    std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+
+    std::vector<size_t> fill_pos(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t face_idx = 0; face_idx < n_faces; ++face_idx)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            adjacency[fill_pos[face_indices[face_idx].at(k)]++] = face_idx;
+        }
+    }
+
+    std::vector<size_t> remaining(n_vertices);
+    std::vector<int> cache_pos(n_vertices, -1);
+    std::vector<float> vertex_scores(n_vertices), face_scores(n_faces, 0.f);
+    for (size_t v = 0; v < n_vertices; ++v)
+    {
+        remaining[v] = adjacency_offsets[v + 1] - adjacency_offsets[v];
+        vertex_scores[v] = vertex_cache_score(-1, remaining[v], cache_size);
+    }
+
+    size_t best_face = no_face;
+    float best_score = -std::numeric_limits<float>::max();
+    for (size_t face_idx = 0; face_idx < n_faces; ++face_idx)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            face_scores[face_idx] += vertex_scores[face_indices[face_idx].at(k)];
+        }
+
+        if (face_scores[face_idx] > best_score)
+        {
+            best_score = face_scores[face_idx];
+            best_face = face_idx;
+        }
+    }
+
+    std::vector<bool> added(n_faces, false);
+    std::vector<size_t> order, cache, new_cache;
+    order.reserve(n_faces);
+    cache.reserve(cache_size + 3);
+    new_cache.reserve(cache_size + 3);
+
+    size_t scan_cursor = 0;
+    while (order.size() < n_faces)
+    {
+        if (best_face == no_face)
+        {
+            // Nothing adjacent to the cache is left, restart from the next unadded face
+            while (added[scan_cursor])
+            {
+                ++scan_cursor;
+            }
+
+            best_face = scan_cursor;
+        }
+
+        added[best_face] = true;
+        order.push_back(best_face);
+
+        new_cache.clear();
+        const IntVector &face = face_indices[best_face];
+        for (size_t k = 0; k < 3; ++k)
+        {
+            const size_t v = face.at(k);
+            const size_t first = adjacency_offsets[v], last = first + remaining[v];
+            for (size_t i = first; i < last; ++i)
+            {
+                if (adjacency[i] == best_face)
+                {
+                    std::swap(adjacency[i], adjacency[last - 1]);
+                    --remaining[v];
+                    break;
+                }
+            }
+
+            if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+            {
+                new_cache.push_back(v);
+            }
+        }
+
+        for (const size_t v : cache)
+        {
+            if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+            {
+                new_cache.push_back(v);
+            }
+        }
+
+        // Vertices pushed past the cache size are evicted but still have to be rescored
+        for (size_t i = 0; i < new_cache.size(); ++i)
+        {
+            const size_t v = new_cache[i];
+            cache_pos[v] = i < cache_size ? static_cast<int>(i) : -1;
+            vertex_scores[v] = vertex_cache_score(cache_pos[v], remaining[v], cache_size);
+        }
+
+        best_face = no_face;
+        best_score = -std::numeric_limits<float>::max();
+        for (const size_t v : new_cache)
+        {
+            const size_t first = adjacency_offsets[v], last = first + remaining[v];
+            for (size_t i = first; i < last; ++i)
+            {
+                const size_t face_idx = adjacency[i];
+                const IntVector &adjacent = face_indices[face_idx];
+                face_scores[face_idx] = vertex_scores[adjacent.x] + vertex_scores[adjacent.y] + vertex_scores[adjacent.z];
+                if (face_scores[face_idx] > best_score)
+                {
+                    best_score = face_scores[face_idx];
+                    best_face = face_idx;
+                }
+            }
+        }
+
+        if (new_cache.size() > cache_size)
+        {
+            new_cache.resize(cache_size);
+        }
+
+        std::swap(cache, new_cache);
+    }
+
+    return order;
+}
+
+std::vector<FaceCluster> optimize_overdraw(
+    const std::vector<Triangle> &faces,
+    const std::vector<IntVector> &face_indices,
+    std::vector<size_t> &order,
+    size_t cache_size,
+    size_t min_cluster_size)
+{
+    std::vector<FaceCluster> clusters;
+    if (order.empty())
+    {
+        return clusters;
+    }
+
+    int n_vertices = 0;
+    for (const auto &face : face_indices)
+    {
+        n_vertices = std::max({n_vertices, face.x + 1, face.y + 1, face.z + 1});
+    }
+
+    // A FIFO cache is simulated, a cluster ends where the cache order is broken anyway
+    const long long cache_length = static_cast<long long>(cache_size);
+    std::vector<long long> cache_time(n_vertices, -cache_length - 1);
+    long long n_misses = 0;
+
+    clusters.emplace_back(0, 0);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const IntVector &face = face_indices[order[i]];
+        size_t face_misses = 0;
+        for (size_t k = 0; k < 3; ++k)
+        {
+            const int v = face.at(k);
+            if (n_misses - cache_time[v] >= cache_length)
+            {
+                cache_time[v] = n_misses++;
+                ++face_misses;
+            }
+        }
+
+        if (face_misses >= 2 && clusters.back().n_faces >= min_cluster_size)
+        {
+            clusters.emplace_back(i, 0);
+        }
+
+        ++clusters.back().n_faces;
+    }
+
+    FloatVector mesh_centroid;
+    float mesh_area = 0.f;
+    for (auto &cluster : clusters)
+    {
+        float cluster_area = 0.f;
+        for (size_t i = cluster.first_face; i < cluster.first_face + cluster.n_faces; ++i)
+        {
+            const Triangle &face = faces[order[i]];
+            const FloatVector normal = (face.p1 - face.p0) ^ (face.p2 - face.p0);
+            const float area = normal.norm() / 2.f;
+
+            cluster.centroid = cluster.centroid + (face.p0 + face.p1 + face.p2) * (area / 3.f);
+            cluster.normal = cluster.normal + normal;
+            cluster_area += area;
+        }
+
+        mesh_centroid = mesh_centroid + cluster.centroid;
+        mesh_area += cluster_area;
+        if (cluster_area > 0.f)
+        {
+            cluster.centroid = cluster.centroid * (1.f / cluster_area);
+        }
+    }
+
+    if (mesh_area > 0.f)
+    {
+        mesh_centroid = mesh_centroid * (1.f / mesh_area);
+    }
+
+    // Clusters facing away from the center of the mesh occlude the rest from most directions
+    std::vector<float> occlusion(clusters.size(), 0.f);
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+        const float normal_norm = clusters[i].normal.norm();
+        if (normal_norm > 0.f)
+        {
+            clusters[i].normal = clusters[i].normal * (1.f / normal_norm);
+            occlusion[i] = (clusters[i].centroid - mesh_centroid) * clusters[i].normal;
+        }
+    }
+
+    std::vector<size_t> cluster_order(clusters.size());
+    std::iota(cluster_order.begin(), cluster_order.end(), 0);
+    std::stable_sort(
+        cluster_order.begin(),
+        cluster_order.end(),
+        [&occlusion](size_t lhs, size_t rhs)
+        { return occlusion[lhs] > occlusion[rhs]; });
+
+    std::vector<size_t> new_order;
+    std::vector<FaceCluster> new_clusters;
+    new_order.reserve(order.size());
+    new_clusters.reserve(clusters.size());
+    for (const size_t cluster_idx : cluster_order)
+    {
+        FaceCluster cluster = clusters[cluster_idx];
+        const size_t first_face = new_order.size();
+        new_order.insert(
+            new_order.end(),
+            order.begin() + cluster.first_face,
+            order.begin() + cluster.first_face + cluster.n_faces);
+
+        cluster.first_face = first_face;
+        new_clusters.push_back(cluster);
+    }
+
+    order.swap(new_order);
+    return new_clusters;
+}
+
+const size_t *sort_clusters_front_to_back(
+    const std::vector<FaceCluster> &clusters,
+    const FloatVector &eye,
+    FrameArena &arena)
+{
+    float *distances = arena.allocate<float>(clusters.size());
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+        const FloatVector to_eye = clusters[i].centroid - eye;
+        distances[i] = to_eye * to_eye;
+    }
+
+    // Ties are broken by the index instead of a stable sort, which would allocate its merge buffer
+    size_t *cluster_order = arena.allocate<size_t>(clusters.size());
+    std::iota(cluster_order, cluster_order + clusters.size(), 0);
+    std::sort(
+        cluster_order,
+        cluster_order + clusters.size(),
+        [distances](size_t lhs, size_t rhs)
+        { return distances[lhs] < distances[rhs] || (distances[lhs] == distances[rhs] && lhs < rhs); });
+
+    return cluster_order;
+}
@@ -0,0 +1,42 @@
+#ifndef __MESH_OPTIMIZER_HPP__
+#define __MESH_OPTIMIZER_HPP__
+
+#include <vector>
+
+#include "math/linalg.hpp"
+#include "math/triangle.hpp"
+#include "memory/frame_arena.hpp"
+
+// A run of consecutive faces that is drawn as a unit
+struct FaceCluster
+{
+    size_t first_face, n_faces;
+    FloatVector centroid, normal;
+
+    FaceCluster();
+    FaceCluster(size_t first_face, size_t n_faces);
+};
+
+// Forsyth's linear-speed vertex cache optimization, returns the new face order
+std::vector<size_t> optimize_vertex_cache(
+    const std::vector<IntVector> &face_indices,
+    size_t n_vertices,
+    size_t cache_size = 32);
+
+// Splits the cache-optimized face order into clusters and sorts them so that the
+// outward-facing ones (the likely occluders) come first. The order is rearranged in place.
+std::vector<FaceCluster> optimize_overdraw(
+    const std::vector<Triangle> &faces,
+    const std::vector<IntVector> &face_indices,
+    std::vector<size_t> &order,
+    size_t cache_size = 32,
+    size_t min_cluster_size = 64);
+
+// Coarse per-frame front-to-back ordering of the clusters, eye is given in model space.
+// Returns the cluster indices, allocated from the arena.
+const size_t *sort_clusters_front_to_back(
+    const std::vector<FaceCluster> &clusters,
+    const FloatVector &eye,
+    FrameArena &arena);
+
+#endif
@@ -1,45 +1,38 @@
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 
 #include "math/linalg.hpp"
+#include "rendering/mesh_optimizer.hpp"
 #include "rendering/model.hpp"
 
 void load_image(sf::Image &image, const std::string &filename)
 {
     if (!image.loadFromFile(filename))
     {
-        throw std::runtime_error("Failed to load image");
+        throw std::runtime_error("Failed to load image " + filename);
     }
 
     image.flipVertically();
 }
 
-void read_vector(std::istringstream &iss, std::vector<FloatVector> &vectors)
+FloatVector read_vector(std::istringstream &iss)
 {
     FloatVector vec;
     iss >> vec.x >> vec.y >> vec.z;
-    vectors.push_back(vec);
+    return vec;
 }
 
-void fill_triangle_vector(
-    const std::vector<IntVector> &indices,
-    const std::vector<FloatVector> &coordinates,
-    std::vector<Triangle> &target)
-{
-    for (const auto &idx : indices)
-    {
-        target.emplace_back(coordinates[idx.x - 1], coordinates[idx.y - 1], coordinates[idx.z - 1]);
-    }
-}
-
-void load_wavefront(
+void read_wavefront_records(
     const std::string &model_filename,
-    std::vector<Triangle> &faces,
-    std::vector<Triangle> &textures,
-    std::vector<Triangle> &normals)
+    const WavefrontVectorCallback &on_vector,
+    const WavefrontIndexCallback &on_face)
 {
     std::ifstream file(model_filename);
     if (file.fail())
@@ -47,9 +40,6 @@ void load_wavefront(
         throw std::runtime_error("Failed to load the model");
     }
 
-    std::vector<FloatVector> vertices, texture_coordinates, normal_vectors;
-    std::vector<IntVector> face_indices, texture_indices, normal_indices;
-
     std::string line;
     while (!file.eof())
     {
@@ -59,15 +49,15 @@ void load_wavefront(
         iss >> line_type;
         if (line_type == "v")
         {
-            read_vector(iss, vertices);
+            on_vector(WAVEFRONT_VERTEX, read_vector(iss));
         }
         else if (line_type == "vt")
         {
-            read_vector(iss, texture_coordinates);
+            on_vector(WAVEFRONT_TEXTURE, read_vector(iss));
         }
         else if (line_type == "vn")
         {
-            read_vector(iss, normal_vectors);
+            on_vector(WAVEFRONT_NORMAL, read_vector(iss));
         }
         else if (line_type == "f")
         {
@@ -78,32 +68,275 @@ void load_wavefront(
                 iss >> face[component] >> char_discard >> texture[component] >> char_discard >> normal[component];
             }
 
-            face_indices.push_back(face);
-            texture_indices.push_back(texture);
-            normal_indices.push_back(normal);
+            // Wavefront indices start from 1
+            on_face(face - IntVector(1, 1, 1), texture - IntVector(1, 1, 1), normal - IntVector(1, 1, 1));
         }
     }
+}
+
+size_t read_wavefront(const std::string &model_filename, const WavefrontFaceCallback &on_face)
+{
+    std::vector<FloatVector> vectors[3];
+    read_wavefront_records(
+        model_filename,
+        [&vectors](WavefrontVectorType type, const FloatVector &vec)
+        {
+            vectors[type].push_back(vec);
+        },
+        [&](const IntVector &face, const IntVector &texture, const IntVector &normal)
+        {
+            // Faces only refer to the vectors defined before them
+            const std::vector<FloatVector> &vertices = vectors[WAVEFRONT_VERTEX],
+                                           &texture_coordinates = vectors[WAVEFRONT_TEXTURE],
+                                           &normal_vectors = vectors[WAVEFRONT_NORMAL];
+            on_face(
+                face,
+                Triangle(vertices.at(face.x), vertices.at(face.y), vertices.at(face.z)),
+                Triangle(texture_coordinates.at(texture.x), texture_coordinates.at(texture.y), texture_coordinates.at(texture.z)),
+                Triangle(normal_vectors.at(normal.x), normal_vectors.at(normal.y), normal_vectors.at(normal.z)));
+        });
+
+    return vectors[WAVEFRONT_VERTEX].size();
+}
+
+void load_wavefront(
+    const std::string &model_filename,
+    std::vector<Triangle> &faces,
+    std::vector<Triangle> &textures,
+    std::vector<Triangle> &normals,
+    std::vector<IntVector> &face_indices,
+    size_t &n_vertices)
+{
+    n_vertices = read_wavefront(
+        model_filename,
+        [&](const IntVector &indices, const Triangle &face, const Triangle &texture, const Triangle &normal)
+        {
+            face_indices.push_back(indices);
+            faces.push_back(face);
+            textures.push_back(texture);
+            normals.push_back(normal);
+        });
+}
+
+template <typename T>
+void permute_vector(std::vector<T> &target, const std::vector<size_t> &order)
+{
+    std::vector<T> permuted;
+    permuted.reserve(order.size());
+    for (const size_t idx : order)
+    {
+        permuted.push_back(target[idx]);
+    }
+
+    target.swap(permuted);
+}
+
+// Clusters are stored field by field, so the file does not depend on the width of size_t or on padding
+const size_t cluster_file_bytes = 2 * sizeof(std::uint64_t) + 6 * sizeof(float);
+
+void write_cluster(std::ostream &stream, const FaceCluster &cluster)
+{
+    write_value(stream, static_cast<std::uint64_t>(cluster.first_face));
+    write_value(stream, static_cast<std::uint64_t>(cluster.n_faces));
+    for (const FloatVector &vec : {cluster.centroid, cluster.normal})
+    {
+        write_value(stream, vec.x);
+        write_value(stream, vec.y);
+        write_value(stream, vec.z);
+    }
+}
 
-    fill_triangle_vector(face_indices, vertices, faces);
-    fill_triangle_vector(texture_indices, texture_coordinates, textures);
-    fill_triangle_vector(normal_indices, normal_vectors, normals);
+// The stream fails if the cluster is truncated
+void read_cluster(std::istream &stream, FaceCluster &cluster)
+{
+    std::uint64_t first_face = 0, n_faces = 0;
+    read_value(stream, first_face);
+    read_value(stream, n_faces);
+    for (FloatVector *vec : {&cluster.centroid, &cluster.normal})
+    {
+        read_value(stream, vec->x);
+        read_value(stream, vec->y);
+        read_value(stream, vec->z);
+    }
+
+    // Kept out of range on 32-bit platforms, so the range check rejects them
+    cluster.first_face = std::min<std::uint64_t>(first_face, std::numeric_limits<size_t>::max());
+    cluster.n_faces = std::min<std::uint64_t>(n_faces, std::numeric_limits<size_t>::max());
+}
+
+bool has_suffix(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
+Model::Model() : is_compact(false) {}
+
 Model::Model(
     const std::string &model_filename,
     const std::string &normal_map_filename,
     const std::string &specular_map_filename,
-    const std::string &diffuse_map_filename)
+    const std::string &diffuse_map_filename,
+    bool optimize_face_order,
+    bool compact_vertices) : is_compact(false)
+{
+    load_image(normal_map, normal_map_filename);
+    load_image(specular_map, specular_map_filename);
+    load_image(diffuse_map, diffuse_map_filename);
+    load_geometry(model_filename, optimize_face_order, compact_vertices);
+}
+
+Model::Model(
+    const std::string &normal_map_filename,
+    const std::string &specular_map_filename,
+    const std::string &diffuse_map_filename) : is_compact(true)
 {
     load_image(normal_map, normal_map_filename);
     load_image(specular_map, specular_map_filename);
     load_image(diffuse_map, diffuse_map_filename);
+}
+
+void Model::load_geometry(const std::string &model_filename, bool optimize_face_order, bool compact_vertices)
+{
+    if (has_suffix(model_filename, ".tmesh"))
+    {
+        std::ifstream file(model_filename, std::ios::binary);
+        if (file.fail())
+        {
+            throw std::runtime_error("Failed to load the model");
+        }
+
+        // The faces were already optimized before saving, the clusters are stored after the mesh
+        compact_mesh.load(file);
+        is_compact = true;
+
+        std::uint64_t n_clusters = 0;
+        read_value(file, n_clusters);
+        if (file.fail() || n_clusters > remaining_stream_bytes(file) / cluster_file_bytes)
+        {
+            throw std::runtime_error("Corrupt compact mesh file");
+        }
+
+        clusters.resize(n_clusters);
+        for (FaceCluster &cluster : clusters)
+        {
+            read_cluster(file, cluster);
+        }
 
+        if (file.fail())
+        {
+            throw std::runtime_error("Truncated compact mesh file");
+        }
+
+        const size_t n_mesh_faces = compact_mesh.n_faces();
+        for (const FaceCluster &cluster : clusters)
+        {
+            if (cluster.first_face > n_mesh_faces || cluster.n_faces > n_mesh_faces - cluster.first_face ||
+                !cluster.centroid.is_finite() || !cluster.normal.is_finite())
+            {
+                throw std::runtime_error("Corrupt compact mesh file");
+            }
+        }
+
+        return;
+    }
+
+    std::vector<IntVector> face_indices;
+    size_t n_vertices = 0;
     load_wavefront(
         model_filename,
         faces,
         textures,
-        normals);
+        normals,
+        face_indices,
+        n_vertices);
+
+    if (optimize_face_order)
+    {
+        std::vector<size_t> order = optimize_vertex_cache(face_indices, n_vertices);
+        clusters = optimize_overdraw(faces, face_indices, order);
+
+        permute_vector(faces, order);
+        permute_vector(textures, order);
+        permute_vector(normals, order);
+    }
+    else
+    {
+        clusters.emplace_back(0, faces.size());
+    }
+
+    if (compact_vertices)
+    {
+        compact();
+    }
+}
+
+void Model::compact()
+{
+    if (is_compact)
+    {
+        return;
+    }
+
+    compact_mesh = CompactMesh(faces, textures, normals);
+    is_compact = true;
+
+    std::vector<Triangle>().swap(faces);
+    std::vector<Triangle>().swap(textures);
+    std::vector<Triangle>().swap(normals);
+}
+
+void Model::save_compact(const std::string &filename) const
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to save the model");
+    }
+
+    if (is_compact)
+    {
+        compact_mesh.save(file);
+    }
+    else
+    {
+        CompactMesh(faces, textures, normals).save(file);
+    }
+
+    write_value(file, static_cast<std::uint64_t>(clusters.size()));
+    for (const FaceCluster &cluster : clusters)
+    {
+        write_cluster(file, cluster);
+    }
+}
+
+size_t Model::vertex_memory() const
+{
+    return is_compact ? compact_mesh.memory_usage() : (faces.size() + textures.size() + normals.size()) * sizeof(Triangle);
+}
+
+size_t Model::n_faces() const
+{
+    return is_compact ? compact_mesh.n_faces() : faces.size();
+}
+
+Triangle Model::face(size_t face_idx) const
+{
+    return is_compact ? compact_mesh.positions(face_idx) : faces[face_idx];
+}
+
+Triangle Model::texture(size_t face_idx) const
+{
+    return is_compact ? compact_mesh.uvs(face_idx) : textures[face_idx];
+}
+
+Triangle Model::normal(size_t face_idx) const
+{
+    return is_compact ? compact_mesh.normals(face_idx) : normals[face_idx];
+}
+
+FloatVector Model::vertex(size_t face_idx, size_t vertex_idx) const
+{
+    return is_compact ? compact_mesh.position(face_idx, vertex_idx) : faces[face_idx].at(vertex_idx);
 }
 
 FloatVector Model::get_normal(size_t pixel_x, size_t pixel_y) const
@@ -119,4 +352,46 @@ float Model::get_specular(size_t pixel_x, size_t pixel_y) const
 {
     const sf::Color color = normal_map.getPixel(pixel_x, pixel_y);
     return color.r / 255.f + 5.f; // One channel is enough, since the image is black and white
-}
\ No newline at end of file
+}
+
+bool vector_less(const FloatVector &lhs, const FloatVector &rhs)
+{
+    return std::tie(lhs.x, lhs.y, lhs.z) < std::tie(rhs.x, rhs.y, rhs.z);
+}
+
+std::vector<LineSegment> Model::edges() const
+{
+    std::vector<LineSegment> result;
+    result.reserve(n_faces() * 3);
+    for (size_t face_idx = 0; face_idx < n_faces(); ++face_idx)
+    {
+        const Triangle face = this->face(face_idx);
+        for (size_t k = 0; k < 3; ++k)
+        {
+            FloatVector p0 = face.at(k), p1 = face.at((k + 1) % 3);
+            if (vector_less(p1, p0))
+            {
+                std::swap(p0, p1);
+            }
+
+            result.emplace_back(p0, p1);
+        }
+    }
+
+    // Edges shared by neighbouring faces are drawn once
+    std::sort(
+        result.begin(),
+        result.end(),
+        [](const LineSegment &lhs, const LineSegment &rhs)
+        { return vector_less(lhs.p0, rhs.p0) || (!vector_less(rhs.p0, lhs.p0) && vector_less(lhs.p1, rhs.p1)); });
+
+    const auto last = std::unique(
+        result.begin(),
+        result.end(),
+        [](const LineSegment &lhs, const LineSegment &rhs)
+        { return !vector_less(lhs.p0, rhs.p0) && !vector_less(rhs.p0, lhs.p0) &&
+                 !vector_less(lhs.p1, rhs.p1) && !vector_less(rhs.p1, lhs.p1); });
+    result.erase(last, result.end());
+
+    return result;
+}
@@ -3,23 +3,91 @@
 
 #include <SFML/Graphics.hpp>
 
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "math/segment.hpp"
 #include "math/triangle.hpp"
+#include "rendering/compact_mesh.hpp"
+#include "rendering/mesh_optimizer.hpp"
+
+enum WavefrontVectorType
+{
+    WAVEFRONT_VERTEX,
+    WAVEFRONT_TEXTURE,
+    WAVEFRONT_NORMAL
+};
+
+using WavefrontVectorCallback = std::function<void(WavefrontVectorType type, const FloatVector &vec)>;
+// Gets the indices of the face's vertices, texture coordinates and normals, starting from 0
+using WavefrontIndexCallback = std::function<void(const IntVector &face, const IntVector &texture, const IntVector &normal)>;
+
+// Streams the records of a Wavefront OBJ file in file order without keeping any of them
+void read_wavefront_records(
+    const std::string &model_filename,
+    const WavefrontVectorCallback &on_vector,
+    const WavefrontIndexCallback &on_face);
+
+// Gets the vertex indices of the face (starting from 0) and its positions, texture coordinates and normals
+using WavefrontFaceCallback = std::function<void(
+    const IntVector &face_indices,
+    const Triangle &face,
+    const Triangle &texture,
+    const Triangle &normal)>;
+
+// Streams the faces of a Wavefront OBJ file, returns the number of vertices. The vectors are kept in memory
+// to resolve the faces.
+size_t read_wavefront(const std::string &model_filename, const WavefrontFaceCallback &on_face);
+
+// Loads the image flipped, so that its rows go from the bottom up like the rows of the screen
+void load_image(sf::Image &image, const std::string &filename);
 
 struct Model
 {
+    // Either the float triangles or the compact mesh hold the geometry, the accessors below work with both
     std::vector<Triangle> faces, textures, normals;
+    CompactMesh compact_mesh;
+    bool is_compact;
+
     sf::Image normal_map, diffuse_map, specular_map;
 
+    // Faces are stored cluster after cluster, in the order produced by the mesh optimizer
+    std::vector<FaceCluster> clusters;
+
+    // Empty, filled in by load_geometry and load_image
+    Model();
+
+    // Model files ending with .tmesh are loaded as compact meshes written by save_compact,
+    // anything else is parsed as Wavefront OBJ. ModelHandle loads the same concurrently.
     Model(
         const std::string &model_filename,
+        const std::string &normal_map_filename,
+        const std::string &specular_map_filename,
+        const std::string &diffuse_map_filename,
+        bool optimize_face_order = true,
+        bool compact_vertices = false);
+
+    // Only loads the maps, the geometry is filled in later, e.g. chunk by chunk when streaming
+    Model(
         const std::string &normal_map_filename,
         const std::string &specular_map_filename,
         const std::string &diffuse_map_filename);
 
+    void load_geometry(const std::string &model_filename, bool optimize_face_order = true, bool compact_vertices = false);
+    void compact();
+    void save_compact(const std::string &filename) const;
+    size_t vertex_memory() const;
+
+    size_t n_faces() const;
+    Triangle face(size_t face_idx) const;
+    Triangle texture(size_t face_idx) const;
+    Triangle normal(size_t face_idx) const;
+    FloatVector vertex(size_t face_idx, size_t vertex_idx) const;
+
     FloatVector get_normal(size_t pixel_x, size_t pixel_y) const;
     float get_specular(size_t pixel_x, size_t pixel_y) const;
+    std::vector<LineSegment> edges() const;
 };
 
 #endif
@@ -0,0 +1,96 @@
+#include <chrono>
+#include <functional>
+
+#include "rendering/model_loader.hpp"
+
+ModelHandle::ModelHandle(
+    const std::string &model_filename,
+    const std::string &normal_map_filename,
+    const std::string &specular_map_filename,
+    const std::string &diffuse_map_filename,
+    bool optimize_face_order,
+    bool compact_vertices) : model(std::make_shared<Model>())
+{
+    resources[MODEL_GEOMETRY] = std::async(
+        std::launch::async,
+        &Model::load_geometry,
+        model.get(),
+        model_filename,
+        optimize_face_order,
+        compact_vertices);
+    load_maps(normal_map_filename, specular_map_filename, diffuse_map_filename);
+}
+
+ModelHandle::ModelHandle(
+    const std::string &normal_map_filename,
+    const std::string &specular_map_filename,
+    const std::string &diffuse_map_filename) : model(std::make_shared<Model>())
+{
+    model->is_compact = true;
+
+    std::promise<void> no_geometry;
+    no_geometry.set_value();
+    resources[MODEL_GEOMETRY] = no_geometry.get_future();
+
+    load_maps(normal_map_filename, specular_map_filename, diffuse_map_filename);
+}
+
+void ModelHandle::load_maps(
+    const std::string &normal_map_filename,
+    const std::string &specular_map_filename,
+    const std::string &diffuse_map_filename)
+{
+    // The jobs write to different members of the model, so they need no synchronization. The handle keeps
+    // the model alive until they are done: the last future waits for its job when it is destroyed.
+    resources[MODEL_NORMAL_MAP] = std::async(std::launch::async, load_image, std::ref(model->normal_map), normal_map_filename);
+    resources[MODEL_SPECULAR_MAP] = std::async(std::launch::async, load_image, std::ref(model->specular_map), specular_map_filename);
+    resources[MODEL_DIFFUSE_MAP] = std::async(std::launch::async, load_image, std::ref(model->diffuse_map), diffuse_map_filename);
+}
+
+Model &ModelHandle::wait(ModelResource resource) const
+{
+    resources[resource].get();
+    return *model;
+}
+
+Model &ModelHandle::wait() const
+{
+    for (const std::shared_future<void> &resource : resources)
+    {
+        resource.get();
+    }
+
+    return *model;
+}
+
+bool ModelHandle::is_ready(ModelResource resource) const
+{
+    return resources[resource].wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+std::shared_ptr<Model> ModelHandle::share() const
+{
+    wait();
+    return model;
+}
+
+std::vector<ModelHandle> load_models(
+    const std::vector<ModelFiles> &files,
+    bool optimize_face_order,
+    bool compact_vertices)
+{
+    std::vector<ModelHandle> handles;
+    handles.reserve(files.size());
+    for (const ModelFiles &model_files : files)
+    {
+        handles.emplace_back(
+            model_files.model_filename,
+            model_files.normal_map_filename,
+            model_files.specular_map_filename,
+            model_files.diffuse_map_filename,
+            optimize_face_order,
+            compact_vertices);
+    }
+
+    return handles;
+}
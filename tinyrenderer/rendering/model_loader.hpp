@@ -0,0 +1,70 @@
+#ifndef __MODEL_LOADER_HPP__
+#define __MODEL_LOADER_HPP__
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rendering/model.hpp"
+
+enum ModelResource
+{
+    MODEL_GEOMETRY,
+    MODEL_NORMAL_MAP,
+    MODEL_SPECULAR_MAP,
+    MODEL_DIFFUSE_MAP,
+    N_MODEL_RESOURCES
+};
+
+// A model that is loaded in the background, every resource on its own thread. Setup can wait for just
+// the resources it needs, e.g. a depth pre-pass only needs the geometry while the maps are still decoding.
+class ModelHandle
+{
+private:
+    std::shared_ptr<Model> model;
+    std::shared_future<void> resources[N_MODEL_RESOURCES];
+
+    void load_maps(
+        const std::string &normal_map_filename,
+        const std::string &specular_map_filename,
+        const std::string &diffuse_map_filename);
+
+public:
+    ModelHandle(
+        const std::string &model_filename,
+        const std::string &normal_map_filename,
+        const std::string &specular_map_filename,
+        const std::string &diffuse_map_filename,
+        bool optimize_face_order = true,
+        bool compact_vertices = false);
+
+    // Only loads the maps, like the Model constructor without a model file. The geometry counts as loaded.
+    ModelHandle(
+        const std::string &normal_map_filename,
+        const std::string &specular_map_filename,
+        const std::string &diffuse_map_filename);
+
+    // Blocks until the resource is loaded, rethrowing its loading error. Until wait() without a resource
+    // has returned, only the resources that were waited for may be used.
+    Model &wait(ModelResource resource) const;
+    Model &wait() const;
+
+    bool is_ready(ModelResource resource) const;
+
+    // Waits for all the resources
+    std::shared_ptr<Model> share() const;
+};
+
+struct ModelFiles
+{
+    std::string model_filename, normal_map_filename, specular_map_filename, diffuse_map_filename;
+};
+
+// Starts loading all the models at once, so the total time is close to that of the slowest resource
+std::vector<ModelHandle> load_models(
+    const std::vector<ModelFiles> &files,
+    bool optimize_face_order = true,
+    bool compact_vertices = false);
+
+#endif
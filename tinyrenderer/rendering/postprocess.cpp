@@ -0,0 +1,715 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <optional>
+
+#include "math/simd.hpp"
+#include "rendering/postprocess.hpp"
+
+const int post_lanes = Float8::size;
+
+// Columns of the vertical blur are processed in strips, so the rows under the kernel stay in cache
+const int blur_strip_width = 256;
+const int max_blur_radius = 64;
+
+const float fxaa_edge_threshold = 1.f / 6.f, fxaa_edge_threshold_min = 1.f / 12.f,
+            fxaa_reduce_min = 1.f / 128.f, fxaa_reduce_mul = 1.f / 8.f, fxaa_span_max = 8.f;
+
+PostProcessTimings::PostProcessTimings() : depth_range(0.),
+                                           downsample(0.),
+                                           blur(0.),
+                                           composite(0.),
+                                           fxaa(0.),
+                                           total(0.) {}
+
+PostProcessSettings::PostProcessSettings() : tone_mapping(false),
+                                             exposure(1.f),
+                                             bloom_strength(0.f),
+                                             bloom_threshold(.8f),
+                                             bloom_radius(24.f),
+                                             dof_range(0.f),
+                                             dof_radius(12.f),
+                                             fxaa(false),
+                                             n_threads(0) {}
+
+bool PostProcessSettings::enabled() const
+{
+    return tone_mapping || bloom_strength > 0.f || dof_range > 0.f || fxaa;
+}
+
+// Rows of floats padded to whole lanes, so the kernels never need a scalar tail
+struct Plane
+{
+    int width, height, stride;
+    float *values;
+
+    Plane() : width(0), height(0), stride(0), values(nullptr) {}
+    Plane(FrameArena &arena, int width, int height) : width(width),
+                                                      height(height),
+                                                      stride((width + post_lanes - 1) / post_lanes * post_lanes),
+                                                      values(arena.allocate<float>(static_cast<size_t>(stride) * height)) {}
+
+    float *row(int y) { return values + static_cast<size_t>(y) * stride; }
+    const float *row(int y) const { return values + static_cast<size_t>(y) * stride; }
+};
+
+Float8 luma(const Float8 &red, const Float8 &green, const Float8 &blue)
+{
+    return red * Float8(.299f) + green * Float8(.587f) + blue * Float8(.114f);
+}
+
+// In [0, 1]
+float luma(const sf::Uint8 *pixel)
+{
+    return (pixel[0] * .299f + pixel[1] * .587f + pixel[2] * .114f) * (1.f / 255.f);
+}
+
+// Filmic curve fitted to ACES by Krzysztof Narkowicz
+Float8 tone_map(const Float8 &color)
+{
+    return (color * (color * Float8(2.51f) + Float8(.03f))) /
+           (color * (color * Float8(2.43f) + Float8(.59f)) + Float8(.14f));
+}
+
+// Eight pixels of a row starting at x, pixels outside of the row repeat the nearest one
+Pixels8 load_clamped(const sf::Uint8 *row, int width, int x)
+{
+    if (x >= 0 && x + post_lanes <= width)
+    {
+        return Pixels8::load(row + x * 4);
+    }
+
+    sf::Uint8 block[post_lanes * 4];
+    for (int lane = 0; lane < post_lanes; ++lane)
+    {
+        std::memcpy(block + lane * 4, row + std::max(0, std::min(width - 1, x + lane)) * 4, 4);
+    }
+
+    return Pixels8::load(block);
+}
+
+// Luma of eight pixels, in [0, 1]
+Float8 load_luma(const sf::Uint8 *row, int width, int x)
+{
+    const Pixels8 pixels = load_clamped(row, width, x);
+    return luma(pixels.red, pixels.green, pixels.blue) * Float8(1.f / 255.f);
+}
+
+// Normalized weights of the taps from -radius to radius
+struct BlurKernel
+{
+    const float *weights;
+    int radius;
+
+    int n_taps() const { return 2 * radius + 1; }
+};
+
+BlurKernel gaussian_kernel(float sigma, FrameArena &arena)
+{
+    const int radius = std::max(1, std::min(max_blur_radius, static_cast<int>(std::ceil(sigma * 3.f))));
+    float *weights = arena.allocate<float>(2 * radius + 1);
+
+    float sum = 0.f;
+    for (int i = -radius; i <= radius; ++i)
+    {
+        weights[i + radius] = std::exp(-.5f * i * i / (sigma * sigma));
+        sum += weights[i + radius];
+    }
+
+    for (int tap = 0; tap <= 2 * radius; ++tap)
+    {
+        weights[tap] /= sum;
+    }
+
+    BlurKernel kernel;
+    kernel.weights = weights;
+    kernel.radius = radius;
+    return kernel;
+}
+
+// Vertical half of the separable Gaussian blur. Columns are processed in strips,
+// so the rows under the kernel stay in cache.
+void blur_columns(Plane *planes, size_t n_planes, const BlurKernel &kernel, Plane &scratch, ThreadPool &pool)
+{
+    const int radius = kernel.radius;
+    for (size_t plane_idx = 0; plane_idx < n_planes; ++plane_idx)
+    {
+        Plane &plane = planes[plane_idx];
+        pool.parallel_rows(
+            plane.height,
+            [&](size_t, int begin, int end)
+            {
+                const float *rows[2 * max_blur_radius + 1];
+                for (int strip = 0; strip < plane.stride; strip += blur_strip_width)
+                {
+                    const int strip_end = std::min(plane.stride, strip + blur_strip_width);
+                    for (int y = begin; y < end; ++y)
+                    {
+                        for (int tap = 0; tap <= 2 * radius; ++tap)
+                        {
+                            rows[tap] = plane.row(std::max(0, std::min(plane.height - 1, y + tap - radius)));
+                        }
+
+                        float *out = scratch.row(y);
+                        for (int x = strip; x < strip_end; x += post_lanes)
+                        {
+                            Float8 sum(0.f);
+                            for (int tap = 0; tap < kernel.n_taps(); ++tap)
+                            {
+                                sum = sum + Float8::load(rows[tap] + x) * Float8(kernel.weights[tap]);
+                            }
+
+                            sum.store(out + x);
+                        }
+                    }
+                }
+            });
+
+        // The blurred rows become the plane and its old rows the scratch of the next one
+        std::swap(plane.values, scratch.values);
+    }
+}
+
+// Horizontal half of the blur, done on demand while compositing: every half resolution row is blurred
+// and upsampled to the full width when first needed. Consecutive full resolution rows share their
+// half resolution rows, so the last two are kept.
+class UpsampledRows
+{
+private:
+    const Plane &plane;
+    const BlurKernel &kernel;
+
+    float *padded, *blurred;
+    float *rows[2];
+    int row_indices[2];
+    int last_used;
+
+public:
+    // The scratch holds scratch_size floats
+    UpsampledRows(const Plane &plane, const BlurKernel &kernel, float *scratch) : plane(plane),
+                                                                                 kernel(kernel),
+                                                                                 padded(scratch),
+                                                                                 blurred(padded + plane.stride + 2 * kernel.radius),
+                                                                                 rows{blurred + plane.stride + 2 * post_lanes,
+                                                                                      blurred + 3 * plane.stride + 2 * post_lanes},
+                                                                                 row_indices{-1, -1},
+                                                                                 last_used(0) {}
+
+    static size_t scratch_size(const Plane &plane, const BlurKernel &kernel)
+    {
+        return 6 * plane.stride + 2 * kernel.radius + 2 * post_lanes;
+    }
+
+    const float *row(int half_y)
+    {
+        for (int slot = 0; slot < 2; ++slot)
+        {
+            if (row_indices[slot] == half_y)
+            {
+                last_used = slot;
+                return rows[slot];
+            }
+        }
+
+        const int slot = 1 - last_used;
+        last_used = slot;
+        row_indices[slot] = half_y;
+
+        // Clamped borders first, so every tap is a plain unaligned load
+        const float *in = plane.row(half_y);
+        for (int x = -kernel.radius; x < plane.stride + kernel.radius; ++x)
+        {
+            padded[x + kernel.radius] = in[std::max(0, std::min(plane.width - 1, x))];
+        }
+
+        float *out = blurred + post_lanes;
+        for (int x = 0; x < plane.stride; x += post_lanes)
+        {
+            Float8 sum(0.f);
+            for (int tap = 0; tap < kernel.n_taps(); ++tap)
+            {
+                sum = sum + Float8::load(padded + x + tap) * Float8(kernel.weights[tap]);
+            }
+
+            sum.store(out + x);
+        }
+
+        out[-1] = out[0];
+        std::fill(out + plane.width, out + plane.stride + 1, out[plane.width - 1]);
+
+        // Full resolution pixels 2i and 2i + 1 lie a quarter of a half resolution pixel before and after i
+        for (int x = 0; x < plane.stride; x += post_lanes)
+        {
+            const Float8 left = Float8::load(out + x - 1), middle = Float8::load(out + x), right = Float8::load(out + x + 1);
+            Float8::store_interleaved(
+                rows[slot] + 2 * x,
+                left * Float8(.25f) + middle * Float8(.75f),
+                middle * Float8(.75f) + right * Float8(.25f));
+        }
+
+        return rows[slot];
+    }
+};
+
+// Depth range of the covered pixels, reduced over the z-buffer columns in place
+void depth_range(const std::vector<std::vector<float>> &zbuf, float &depth_min, float &depth_max, ThreadPool &pool)
+{
+    const float background = -std::numeric_limits<float>::max();
+    depth_min = std::numeric_limits<float>::max();
+    depth_max = background;
+
+    std::mutex range_mutex;
+    pool.parallel_rows(
+        zbuf.size(),
+        [&](size_t, int begin, int end)
+        {
+            float band_min = std::numeric_limits<float>::max(), band_max = background;
+            for (int x = begin; x < end; ++x)
+            {
+                for (const float z : zbuf[x])
+                {
+                    // The background is the lowest float, it only has to be kept out of the minimum
+                    band_min = std::min(band_min, z != background ? z : band_min);
+                    band_max = std::max(band_max, z);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(range_mutex);
+            depth_min = std::min(depth_min, band_min);
+            depth_max = std::max(depth_max, band_max);
+        });
+}
+
+// Averages 2x2 blocks of the screen into half resolution planes: the plain color for the depth of field
+// and the part above the bloom threshold for the bloom
+void downsample(
+    const sf::Uint8 *pixels,
+    int width,
+    int height,
+    Plane *half_color,
+    Plane *half_bright,
+    float bloom_threshold,
+    ThreadPool &pool)
+{
+    const int half_width = half_color ? half_color[0].width : half_bright[0].width,
+              half_stride = half_color ? half_color[0].stride : half_bright[0].stride,
+              half_height = half_color ? half_color[0].height : half_bright[0].height;
+
+    pool.parallel_rows(
+        half_height,
+        [&](size_t, int begin, int end)
+        {
+            float channels[3][post_lanes];
+            for (int half_y = begin; half_y < end; ++half_y)
+            {
+                const int y0 = std::min(height - 1, half_y * 2), y1 = std::min(height - 1, half_y * 2 + 1);
+                const sf::Uint8 *row0 = pixels + static_cast<size_t>(y0) * width * 4,
+                                *row1 = pixels + static_cast<size_t>(y1) * width * 4;
+                for (int half_x = 0; half_x < half_stride; half_x += post_lanes)
+                {
+                    const int x0 = half_x * 2;
+                    if (x0 + 2 * post_lanes <= width)
+                    {
+                        // Both rows are added first, then the neighbouring columns
+                        const Pixels8 top_left = Pixels8::load(row0 + x0 * 4),
+                                      top_right = Pixels8::load(row0 + (x0 + post_lanes) * 4),
+                                      bottom_left = Pixels8::load(row1 + x0 * 4),
+                                      bottom_right = Pixels8::load(row1 + (x0 + post_lanes) * 4);
+                        Float8::pairwise_sum(top_left.red + bottom_left.red, top_right.red + bottom_right.red).store(channels[0]);
+                        Float8::pairwise_sum(top_left.green + bottom_left.green, top_right.green + bottom_right.green).store(channels[1]);
+                        Float8::pairwise_sum(top_left.blue + bottom_left.blue, top_right.blue + bottom_right.blue).store(channels[2]);
+                    }
+                    else
+                    {
+                        // The right border, columns past the image repeat the last one
+                        for (int lane = 0; lane < post_lanes; ++lane)
+                        {
+                            const int left_x = std::min(width - 1, std::min(half_width - 1, half_x + lane) * 2),
+                                      right_x = std::min(width - 1, left_x + 1);
+                            const sf::Uint8 *p00 = row0 + left_x * 4, *p01 = row0 + right_x * 4,
+                                            *p10 = row1 + left_x * 4, *p11 = row1 + right_x * 4;
+                            for (int channel = 0; channel < 3; ++channel)
+                            {
+                                channels[channel][lane] = p00[channel] + p01[channel] + p10[channel] + p11[channel];
+                            }
+                        }
+                    }
+
+                    const Float8 scale(1.f / (4.f * 255.f));
+                    const Float8 red = Float8::load(channels[0]) * scale,
+                                 green = Float8::load(channels[1]) * scale,
+                                 blue = Float8::load(channels[2]) * scale;
+                    if (half_color)
+                    {
+                        red.store(half_color[0].row(half_y) + half_x);
+                        green.store(half_color[1].row(half_y) + half_x);
+                        blue.store(half_color[2].row(half_y) + half_x);
+                    }
+
+                    if (half_bright)
+                    {
+                        // Soft threshold, the color is kept and only scaled by how far its luma exceeds the threshold
+                        const Float8 brightness = luma(red, green, blue);
+                        const Float8 factor = (brightness - Float8(bloom_threshold)).max(Float8(0.f)) /
+                                              brightness.max(Float8(1e-4f));
+                        (red * factor).store(half_bright[0].row(half_y) + half_x);
+                        (green * factor).store(half_bright[1].row(half_y) + half_x);
+                        (blue * factor).store(half_bright[2].row(half_y) + half_x);
+                    }
+                }
+            }
+        });
+}
+
+// Where a full resolution pixel falls between two half resolution samples
+struct UpsampleTap
+{
+    int lo, hi;
+    float weight;
+};
+
+const UpsampleTap *upsample_taps(int n_full, int n_half, FrameArena &arena)
+{
+    UpsampleTap *taps = arena.allocate<UpsampleTap>(n_full);
+    for (int i = 0; i < n_full; ++i)
+    {
+        const float position = std::max(0.f, (i + .5f) * .5f - .5f);
+        taps[i].lo = std::min(n_half - 1, static_cast<int>(position));
+        taps[i].hi = std::min(n_half - 1, taps[i].lo + 1);
+        taps[i].weight = position - taps[i].lo;
+    }
+
+    return taps;
+}
+
+// Bilinear sample of the color channels, the position is clamped to the image
+void sample_color(const sf::Uint8 *pixels, int width, int height, float x, float y, float *color)
+{
+    x = std::max(0.f, std::min(width - 1.f, x));
+    y = std::max(0.f, std::min(height - 1.f, y));
+    const int x0 = x, y0 = y, x1 = std::min(width - 1, x0 + 1), y1 = std::min(height - 1, y0 + 1);
+    const float weight_x = x - x0, weight_y = y - y0;
+
+    const sf::Uint8 *p00 = pixels + (static_cast<size_t>(y0) * width + x0) * 4,
+                    *p01 = pixels + (static_cast<size_t>(y0) * width + x1) * 4,
+                    *p10 = pixels + (static_cast<size_t>(y1) * width + x0) * 4,
+                    *p11 = pixels + (static_cast<size_t>(y1) * width + x1) * 4;
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        const float top = p00[channel] + (p01[channel] - p00[channel]) * weight_x,
+                    bottom = p10[channel] + (p11[channel] - p10[channel]) * weight_x;
+        color[channel] = top + (bottom - top) * weight_y;
+    }
+}
+
+// Searches along the direction across the edge, with the corner lumas giving the direction.
+// Only the color is written, the alpha was copied with the rest of the row.
+void fxaa_pixel(const sf::Uint8 *in, sf::Uint8 *out, int width, int height, int x, int y)
+{
+    const int left = std::max(0, x - 1), right = std::min(width - 1, x + 1),
+              up = std::max(0, y - 1), down = std::min(height - 1, y + 1);
+    auto pixel = [&](int pixel_x, int pixel_y)
+    {
+        return in + (static_cast<size_t>(pixel_y) * width + pixel_x) * 4;
+    };
+
+    const float luma_nw = luma(pixel(left, up)), luma_ne = luma(pixel(right, up)),
+                luma_sw = luma(pixel(left, down)), luma_se = luma(pixel(right, down)),
+                luma_m = luma(pixel(x, y));
+    const float luma_min = std::min(luma_m, std::min(std::min(luma_nw, luma_ne), std::min(luma_sw, luma_se))),
+                luma_max = std::max(luma_m, std::max(std::max(luma_nw, luma_ne), std::max(luma_sw, luma_se)));
+
+    float dir_x = -((luma_nw + luma_ne) - (luma_sw + luma_se)),
+          dir_y = (luma_nw + luma_sw) - (luma_ne + luma_se);
+    const float dir_reduce = std::max((luma_nw + luma_ne + luma_sw + luma_se) * .25f * fxaa_reduce_mul, fxaa_reduce_min),
+                inverse_dir_min = 1.f / (std::min(std::abs(dir_x), std::abs(dir_y)) + dir_reduce);
+    dir_x = std::max(-fxaa_span_max, std::min(fxaa_span_max, dir_x * inverse_dir_min));
+    dir_y = std::max(-fxaa_span_max, std::min(fxaa_span_max, dir_y * inverse_dir_min));
+
+    float near_1[3], near_2[3], far_1[3], far_2[3];
+    sample_color(in, width, height, x + dir_x * (1.f / 3.f - .5f), y + dir_y * (1.f / 3.f - .5f), near_1);
+    sample_color(in, width, height, x + dir_x * (2.f / 3.f - .5f), y + dir_y * (2.f / 3.f - .5f), near_2);
+    sample_color(in, width, height, x - dir_x * .5f, y - dir_y * .5f, far_1);
+    sample_color(in, width, height, x + dir_x * .5f, y + dir_y * .5f, far_2);
+
+    sf::Uint8 color_a[3], color_b[3];
+    for (int channel = 0; channel < 3; ++channel)
+    {
+        const float near = .5f * (near_1[channel] + near_2[channel]);
+        color_a[channel] = static_cast<sf::Uint8>(near + .5f);
+        color_b[channel] = static_cast<sf::Uint8>(.5f * near + .25f * (far_1[channel] + far_2[channel]) + .5f);
+    }
+
+    // The wider blend is only taken if it did not leave the local luma range
+    const float luma_b = luma(color_b);
+    std::memcpy(out + (static_cast<size_t>(y) * width + x) * 4, luma_b < luma_min || luma_b > luma_max ? color_a : color_b, 3);
+}
+
+PostProcessor::PostProcessor(const PostProcessSettings &settings) : settings(settings), pool(settings.n_threads) {}
+
+const PostProcessTimings &PostProcessor::last_timings() const
+{
+    return timings;
+}
+
+void PostProcessor::apply(sf::Image &screen, const std::vector<std::vector<float>> &zbuf)
+{
+    timings = PostProcessTimings();
+    if (!settings.enabled())
+    {
+        return;
+    }
+
+    const auto screen_size = screen.getSize();
+    const int width = screen_size.x, height = screen_size.y;
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    const auto start_time = std::chrono::steady_clock::now();
+    auto pass_start_time = start_time;
+
+    // Adds the time since the end of the previous pass to the given one
+    auto end_pass = [&](double &pass_ms)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        pass_ms += milliseconds(now - pass_start_time).count();
+        pass_start_time = now;
+    };
+
+    const sf::Uint8 *pixels = screen.getPixelsPtr();
+
+    const bool bloom = settings.bloom_strength > 0.f, dof = settings.dof_range > 0.f;
+
+    float focus_depth = 0.f, inverse_focus_range = 0.f;
+    if (dof)
+    {
+        float depth_min = 0.f, depth_max = 0.f;
+        depth_range(zbuf, depth_min, depth_max, pool);
+        if (depth_min > depth_max)
+        {
+            depth_min = depth_max = 0.f;
+        }
+
+        const float center_depth = zbuf[width / 2][height / 2];
+        focus_depth = center_depth >= depth_min ? center_depth : (depth_min + depth_max) * .5f;
+        inverse_focus_range = 1.f / std::max(1e-6f, settings.dof_range * (depth_max - depth_min));
+        end_pass(timings.depth_range);
+    }
+
+    // Blurs run at half resolution. Only their vertical pass is a separate traversal, the horizontal pass
+    // and the upsampling happen row by row while compositing.
+    const int half_width = (width + 1) / 2, half_height = (height + 1) / 2;
+    Plane color_planes[3], bright_planes[3];
+    BlurKernel dof_kernel = {}, bloom_kernel = {};
+    if (bloom || dof)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            if (dof)
+            {
+                color_planes[channel] = Plane(arena, half_width, half_height);
+            }
+
+            if (bloom)
+            {
+                bright_planes[channel] = Plane(arena, half_width, half_height);
+            }
+        }
+
+        downsample(
+            pixels,
+            width,
+            height,
+            dof ? color_planes : nullptr,
+            bloom ? bright_planes : nullptr,
+            settings.bloom_threshold,
+            pool);
+        end_pass(timings.downsample);
+
+        Plane scratch(arena, half_width, half_height);
+        if (dof)
+        {
+            dof_kernel = gaussian_kernel(std::max(.5f, settings.dof_radius / 6.f), arena);
+            blur_columns(color_planes, 3, dof_kernel, scratch, pool);
+        }
+
+        if (bloom)
+        {
+            bloom_kernel = gaussian_kernel(std::max(.5f, settings.bloom_radius / 6.f), arena);
+            blur_columns(bright_planes, 3, bloom_kernel, scratch, pool);
+        }
+
+        end_pass(timings.blur);
+    }
+
+    const UpsampleTap *row_taps = upsample_taps(height, half_height, arena);
+
+    // Every band of rows upsamples its own half resolution rows
+    const size_t dof_scratch_size = dof ? UpsampledRows::scratch_size(color_planes[0], dof_kernel) : 0,
+                 bloom_scratch_size = bloom ? UpsampledRows::scratch_size(bright_planes[0], bloom_kernel) : 0,
+                 band_scratch_size = 3 * (dof_scratch_size + bloom_scratch_size);
+    float *row_scratch = arena.allocate<float>(pool.band_count(height) * band_scratch_size);
+
+    // Depth of field, bloom, exposure and tone mapping, all in one traversal
+    sf::Uint8 *composited = arena.allocate<sf::Uint8>(static_cast<size_t>(width) * height * 4);
+    pool.parallel_rows(
+        height,
+        [&](size_t band_idx, int begin, int end)
+        {
+            std::optional<UpsampledRows> dof_rows[3], bloom_rows[3];
+            float *band_scratch = row_scratch + band_idx * band_scratch_size;
+            for (int channel = 0; channel < 3 && dof; ++channel, band_scratch += dof_scratch_size)
+            {
+                dof_rows[channel].emplace(color_planes[channel], dof_kernel, band_scratch);
+            }
+
+            for (int channel = 0; channel < 3 && bloom; ++channel, band_scratch += bloom_scratch_size)
+            {
+                bloom_rows[channel].emplace(bright_planes[channel], bloom_kernel, band_scratch);
+            }
+
+            const float *dof_lo[3], *dof_hi[3], *bloom_lo[3], *bloom_hi[3];
+            float depths[post_lanes];
+            sf::Uint8 border[post_lanes * 4];
+            for (int y = begin; y < end; ++y)
+            {
+                const UpsampleTap &row_tap = row_taps[y];
+                const Float8 row_weight(row_tap.weight);
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    if (dof)
+                    {
+                        dof_lo[channel] = dof_rows[channel]->row(row_tap.lo);
+                        dof_hi[channel] = dof_rows[channel]->row(row_tap.hi);
+                    }
+
+                    if (bloom)
+                    {
+                        bloom_lo[channel] = bloom_rows[channel]->row(row_tap.lo);
+                        bloom_hi[channel] = bloom_rows[channel]->row(row_tap.hi);
+                    }
+                }
+
+                const sf::Uint8 *in_row = pixels + static_cast<size_t>(y) * width * 4;
+                sf::Uint8 *out_row = composited + static_cast<size_t>(y) * width * 4;
+                for (int x = 0; x < width; x += post_lanes)
+                {
+                    // The last block of a row is padded by repeating the last pixel
+                    const int n_pixels = std::min(post_lanes, width - x);
+                    Pixels8 block = load_clamped(in_row, width, x);
+                    Float8 *color[3] = {&block.red, &block.green, &block.blue};
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        *color[channel] = *color[channel] * Float8(1.f / 255.f);
+                    }
+
+                    if (dof)
+                    {
+                        // Gathered across the z-buffer columns, which stay in cache from one row to the next
+                        for (int lane = 0; lane < post_lanes; ++lane)
+                        {
+                            depths[lane] = zbuf[std::min(width - 1, x + lane)][y];
+                        }
+
+                        // Uncovered pixels are at the lowest float, infinitely far from the focus
+                        const Float8 pixel_depth = Float8::load(depths);
+                        const Float8 distance = (pixel_depth - Float8(focus_depth)).max(Float8(focus_depth) - pixel_depth);
+                        const Float8 blur = (distance * Float8(inverse_focus_range)).min(Float8(1.f));
+                        for (int channel = 0; channel < 3; ++channel)
+                        {
+                            const Float8 lo = Float8::load(dof_lo[channel] + x), hi = Float8::load(dof_hi[channel] + x);
+                            const Float8 blurred = lo + (hi - lo) * row_weight;
+                            *color[channel] = *color[channel] + (blurred - *color[channel]) * blur;
+                        }
+                    }
+
+                    if (bloom)
+                    {
+                        for (int channel = 0; channel < 3; ++channel)
+                        {
+                            const Float8 lo = Float8::load(bloom_lo[channel] + x), hi = Float8::load(bloom_hi[channel] + x);
+                            *color[channel] = *color[channel] + (lo + (hi - lo) * row_weight) * Float8(settings.bloom_strength);
+                        }
+                    }
+
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        if (settings.tone_mapping)
+                        {
+                            *color[channel] = tone_map(*color[channel] * Float8(settings.exposure));
+                        }
+
+                        *color[channel] = color[channel]->max(Float8(0.f)).min(Float8(1.f)) * Float8(255.f);
+                    }
+
+                    if (n_pixels < post_lanes)
+                    {
+                        block.store(border);
+                        std::memcpy(out_row + x * 4, border, n_pixels * 4);
+                    }
+                    else
+                    {
+                        block.store(out_row + x * 4);
+                    }
+                }
+            }
+        });
+
+    end_pass(timings.composite);
+
+    const sf::Uint8 *result = composited;
+    if (settings.fxaa)
+    {
+        // Ping-pong: FXAA reads the composited image and only rewrites the pixels on edges
+        sf::Uint8 *antialiased = arena.allocate<sf::Uint8>(static_cast<size_t>(width) * height * 4);
+        pool.parallel_rows(
+            height,
+            [&](size_t, int begin, int end)
+            {
+                for (int y = begin; y < end; ++y)
+                {
+                    const sf::Uint8 *row_up = composited + static_cast<size_t>(std::max(0, y - 1)) * width * 4,
+                                    *row = composited + static_cast<size_t>(y) * width * 4,
+                                    *row_down = composited + static_cast<size_t>(std::min(height - 1, y + 1)) * width * 4;
+                    std::memcpy(antialiased + static_cast<size_t>(y) * width * 4, row, width * 4);
+
+                    for (int x = 0; x < width; x += post_lanes)
+                    {
+                        const Float8 middle = load_luma(row, width, x),
+                                     up = load_luma(row_up, width, x),
+                                     down = load_luma(row_down, width, x),
+                                     left = load_luma(row, width, x - 1),
+                                     right = load_luma(row, width, x + 1);
+                        const Float8 luma_max = middle.max(up).max(down).max(left).max(right),
+                                     luma_min = middle.min(up).min(down).min(left).min(right);
+                        const Float8 threshold = (luma_max * Float8(fxaa_edge_threshold)).max(Float8(fxaa_edge_threshold_min));
+
+                        const int n_pixels = std::min(post_lanes, width - x);
+                        const int edges = ~(luma_max - luma_min - threshold).negative_mask() & ((1 << n_pixels) - 1);
+                        for (int lane = 0; lane < n_pixels; ++lane)
+                        {
+                            if (edges & (1 << lane))
+                            {
+                                fxaa_pixel(composited, antialiased, width, height, x + lane, y);
+                            }
+                        }
+                    }
+                }
+            });
+
+        result = antialiased;
+        end_pass(timings.fxaa);
+    }
+
+    screen.create(width, height, result);
+
+    // Everything is released at once, the next frame of the same size reuses the same memory
+    arena.reset();
+    timings.total = milliseconds(std::chrono::steady_clock::now() - start_time).count();
+}
@@ -0,0 +1,64 @@
+#ifndef __POSTPROCESS_HPP__
+#define __POSTPROCESS_HPP__
+
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "memory/frame_arena.hpp"
+#include "rendering/thread_pool.hpp"
+
+// Every effect is disabled by default
+struct PostProcessSettings
+{
+    // Colors are scaled by the exposure and mapped back into [0, 1] with a filmic curve
+    bool tone_mapping;
+    float exposure;
+
+    // Colors brighter than the threshold are blurred with the given radius (in pixels) and added back
+    float bloom_strength, bloom_threshold, bloom_radius;
+
+    // Autofocuses on the depth at the center of the screen. Pixels further from it than the range,
+    // given as a fraction of the depth range of the scene, are fully blurred.
+    float dof_range, dof_radius;
+
+    bool fxaa;
+
+    // 0 uses every hardware thread
+    size_t n_threads;
+
+    PostProcessSettings();
+
+    bool enabled() const;
+};
+
+// Milliseconds spent in every pass of the last frame, passes that did not run are 0.
+// The blur only covers the vertical half, the horizontal half and the upsampling are part of the composite.
+struct PostProcessTimings
+{
+    double depth_range, downsample, blur, composite, fxaa, total;
+
+    PostProcessTimings();
+};
+
+// Post-processing stage, its scratch memory comes from an arena and its threads from a pool,
+// both are kept between frames
+class PostProcessor
+{
+private:
+    const PostProcessSettings settings;
+    FrameArena arena;
+    ThreadPool pool;
+    PostProcessTimings timings;
+
+public:
+    explicit PostProcessor(const PostProcessSettings &settings);
+
+    const PostProcessTimings &last_timings() const;
+
+    // Applies the enabled effects to the screen, the z-buffer is only read for the depth of field.
+    // Per-pixel effects are fused into a single traversal, blurs run at half resolution.
+    void apply(sf::Image &screen, const std::vector<std::vector<float>> &zbuf);
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <optional>
+
+#include "math/triangle.hpp"
+#include "rendering/draw.hpp"
+#include "rendering/preview.hpp"
+
+void draw_model_progressive(
+    sf::Image &screen,
+    const Model &model,
+    std::vector<std::vector<float>> &zbuf,
+    Shader &shader,
+    const FloatVector &eye,
+    size_t n_passes,
+    const PreviewCallback &callback,
+    FrameArena &arena)
+{
+    const auto screen_size = screen.getSize();
+    const int screen_width = screen_size.x, screen_height = screen_size.y;
+    n_passes = std::max<size_t>(1, n_passes);
+
+    // The first pass samples every 2^(n_passes - 1)th pixel. Passes coarser than the screen would only shade its
+    // corner pixel again, so at most floor(log2(max(width, height))) + 1 passes are drawn.
+    const size_t max_side = std::max(screen_width, screen_height);
+    size_t max_passes = 1;
+    while ((static_cast<size_t>(1) << max_passes) <= max_side)
+    {
+        ++max_passes;
+    }
+
+    n_passes = std::min(n_passes, max_passes);
+
+    // Visibility buffer, column after column like the z-buffer
+    const size_t n_pixels = static_cast<size_t>(screen_width) * screen_height;
+    int *face_ids = arena.allocate<int>(n_pixels, -1);
+
+    const size_t *cluster_order = sort_clusters_front_to_back(model.clusters, eye, arena);
+    for (size_t i = 0; i < model.clusters.size(); ++i)
+    {
+        const FaceCluster &cluster = model.clusters[cluster_order[i]];
+        for (size_t face_idx = cluster.first_face; face_idx < cluster.first_face + cluster.n_faces; ++face_idx)
+        {
+            Triangle screen_coords;
+            shader.begin_face(face_idx);
+            for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+            {
+                screen_coords[vertex_idx] = shader.vertex(face_idx, vertex_idx);
+            }
+
+            draw_triangle_visibility(screen_coords, face_idx, zbuf, face_ids);
+        }
+    }
+
+    // The shader keeps per-face state, so the vertex stage only reruns when the face changes
+    int current_face = -1;
+    std::optional<VaryingPlanes> planes;
+    bool *shaded = arena.allocate<bool>(n_pixels, false);
+    for (size_t pass = 0; pass < n_passes; ++pass)
+    {
+        const int step = static_cast<int>(static_cast<size_t>(1) << (n_passes - 1 - pass));
+        for (int x = 0; x < screen_width; x += step)
+        {
+            for (int y = 0; y < screen_height; y += step)
+            {
+                const size_t pixel_idx = static_cast<size_t>(x) * screen_height + y;
+                const int face_idx = face_ids[pixel_idx];
+                if (face_idx < 0 || shaded[pixel_idx])
+                {
+                    continue;
+                }
+
+                if (face_idx != current_face)
+                {
+                    Triangle screen_coords;
+                    shader.begin_face(face_idx);
+                    for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+                    {
+                        screen_coords[vertex_idx] = shader.vertex(face_idx, vertex_idx);
+                    }
+
+                    planes.emplace(screen_coords, shader);
+                    current_face = face_idx;
+                }
+
+                float varyings[max_varyings];
+                planes->evaluate(x, y, varyings);
+
+                sf::Color color = sf::Color::Black;
+                shader.fragment(x, y, varyings, color);
+                screen.setPixel(x, y, color);
+                shaded[pixel_idx] = true;
+
+                // Fill the rest of the sample's block until those pixels get their own samples
+                for (int block_x = x; block_x < std::min(x + step, screen_width); ++block_x)
+                {
+                    for (int block_y = y; block_y < std::min(y + step, screen_height); ++block_y)
+                    {
+                        const size_t block_pixel_idx = static_cast<size_t>(block_x) * screen_height + block_y;
+                        if (face_ids[block_pixel_idx] >= 0 && !shaded[block_pixel_idx])
+                        {
+                            screen.setPixel(block_x, block_y, color);
+                        }
+                    }
+                }
+            }
+        }
+
+        callback(screen, pass, n_passes);
+    }
+}
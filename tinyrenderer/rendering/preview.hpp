@@ -0,0 +1,34 @@
+#ifndef __PREVIEW_HPP__
+#define __PREVIEW_HPP__
+
+#include <functional>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "math/linalg.hpp"
+#include "memory/frame_arena.hpp"
+#include "rendering/model.hpp"
+#include "rendering/shader.hpp"
+
+// Called with the screen after every pass, the last pass is the final image
+using PreviewCallback = std::function<void(const sf::Image &screen, size_t pass, size_t n_passes)>;
+
+// Draws the model like draw_model, but progressively. The visible face of every pixel is resolved first
+// without shading, then the pixels are shaded on grids that get twice finer with every pass. Pixels between
+// the samples show the color of the nearest coarser sample until they get shaded themselves. Shaded samples
+// are kept, so the last pass only shades the remaining pixels and matches draw_model exactly.
+// n_passes is capped at floor(log2(max(width, height))) + 1, the callback gets the number of passes drawn.
+// Shaders that discard fragments are not supported, the visibility pass cannot know about the discards.
+// The visibility buffer is allocated from the arena.
+void draw_model_progressive(
+    sf::Image &screen,
+    const Model &model,
+    std::vector<std::vector<float>> &zbuf,
+    Shader &shader,
+    const FloatVector &eye,
+    size_t n_passes,
+    const PreviewCallback &callback,
+    FrameArena &arena);
+
+#endif
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <stdexcept>
 
 #include "math/triangle.hpp"
 #include "rendering/shader.hpp"
@@ -8,12 +9,45 @@ Shader::Shader(
     const Matrix &model_mat,
     const Matrix &view_mat,
     const Matrix &proj_mat,
-    const Matrix &viewport_mat) : model(model),
-                                  model_mat(model_mat),
-                                  view_mat(view_mat),
-                                  proj_mat(proj_mat),
-                                  viewport_mat(viewport_mat),
-                                  transformation_mat(viewport_mat * proj_mat * view_mat * model_mat) {}
+    const Matrix &viewport_mat,
+    size_t n_varyings) : model(model),
+                         model_mat(model_mat),
+                         view_mat(view_mat),
+                         proj_mat(proj_mat),
+                         viewport_mat(viewport_mat),
+                         transformation_mat(viewport_mat * proj_mat * view_mat * model_mat),
+                         n_varyings(n_varyings)
+{
+    if (n_varyings > max_varyings)
+    {
+        throw std::runtime_error("Too many varyings");
+    }
+}
+
+FloatVector Shader::project(const FloatVector &position, size_t vertex_idx)
+{
+    float w = 1.f;
+    const FloatVector screen_position = transformation_mat.transform(position, w);
+    inverse_w[vertex_idx] = 1.f / w;
+    return screen_position;
+}
+
+size_t Shader::varying_count() const
+{
+    return n_varyings;
+}
+
+const float *Shader::vertex_varyings(size_t vertex_idx) const
+{
+    return varying_values[vertex_idx];
+}
+
+float Shader::vertex_inverse_w(size_t vertex_idx) const
+{
+    return inverse_w[vertex_idx];
+}
+
+void Shader::begin_face(size_t) {}
 
 SimpleShader::SimpleShader(
     const Model &model,
@@ -21,24 +55,35 @@ SimpleShader::SimpleShader(
     const Matrix &view_mat,
     const Matrix &proj_mat,
     const Matrix &viewport_mat,
-    const FloatVector &light) : Shader(model, model_mat, view_mat, proj_mat, viewport_mat),
-                                light(light),
-                                texture_width(model.diffuse_map.getSize().x),
-                                texture_height(model.diffuse_map.getSize().y) {}
+    const FloatVector &light,
+    size_t n_varyings) : Shader(model, model_mat, view_mat, proj_mat, viewport_mat, n_varyings),
+                         light(light),
+                         texture_width(model.diffuse_map.getSize().x),
+                         texture_height(model.diffuse_map.getSize().y) {}
 
-FloatVector SimpleShader::vertex(size_t face_idx, size_t vertex_idx)
+void SimpleShader::set_texture_varyings(size_t face_idx, size_t vertex_idx)
 {
-    const Triangle face = model.faces[face_idx];
+    const FloatVector texture = model.texture(face_idx).at(vertex_idx);
+    varying_values[vertex_idx][TEXTURE_X] = texture.x * texture_width;
+    varying_values[vertex_idx][TEXTURE_Y] = texture.y * texture_height;
+}
 
+// The flat illumination only depends on the face
+void SimpleShader::begin_face(size_t face_idx)
+{
+    const Triangle face = model.face(face_idx);
     const FloatVector normal = (face.p2 - face.p0) ^ (face.p1 - face.p0);
     face_illumination = light * normal / (light.norm() * normal.norm());
+}
 
-    texture_triangle = model.textures[face_idx];
+FloatVector SimpleShader::vertex(size_t face_idx, size_t vertex_idx)
+{
+    set_texture_varyings(face_idx, vertex_idx);
 
-    return (transformation_mat * Matrix(face.at(vertex_idx))).to_vector();
+    return project(model.vertex(face_idx, vertex_idx), vertex_idx);
 }
 
-bool SimpleShader::fragment(const FloatVector &barycentric, sf::Color &color)
+bool SimpleShader::fragment(int, int, const float *varyings, sf::Color &color)
 {
     if (face_illumination <= 0.f)
     {
@@ -46,10 +91,7 @@ bool SimpleShader::fragment(const FloatVector &barycentric, sf::Color &color)
         return false;
     }
 
-    const float texture_x = texture_triangle.scale_barycentric(VectorComponent::X, barycentric) * texture_width,
-                texture_y = texture_triangle.scale_barycentric(VectorComponent::Y, barycentric) * texture_height;
-
-    color = model.diffuse_map.getPixel(texture_x, texture_y);
+    color = model.diffuse_map.getPixel(varyings[TEXTURE_X], varyings[TEXTURE_Y]);
     color.r *= face_illumination;
     color.g *= face_illumination;
     color.b *= face_illumination;
@@ -57,24 +99,31 @@ bool SimpleShader::fragment(const FloatVector &barycentric, sf::Color &color)
     return false;
 }
 
+GouraudShader::GouraudShader(
+    const Model &model,
+    const Matrix &model_mat,
+    const Matrix &view_mat,
+    const Matrix &proj_mat,
+    const Matrix &viewport_mat,
+    const FloatVector &light) : SimpleShader(model, model_mat, view_mat, proj_mat, viewport_mat, light, N_VARYINGS) {}
+
+void GouraudShader::begin_face(size_t) {}
+
 FloatVector GouraudShader::vertex(size_t face_idx, size_t vertex_idx)
 {
-    const Triangle face = model.faces[face_idx], normals = model.normals[face_idx];
-    texture_triangle = model.textures[face_idx];
+    const FloatVector normal = model.normal(face_idx).at(vertex_idx);
+    varying_values[vertex_idx][ILLUMINATION] = std::abs(light * normal / (light.norm() * normal.norm()));
 
-    const FloatVector normal = normals.at(vertex_idx);
-    varying_illumination[vertex_idx] = std::abs(light * normal / (light.norm() * normal.norm()));
+    set_texture_varyings(face_idx, vertex_idx);
 
-    return (transformation_mat * Matrix(face.at(vertex_idx))).to_vector();
+    return project(model.vertex(face_idx, vertex_idx), vertex_idx);
 }
 
-bool GouraudShader::fragment(const FloatVector &barycentric, sf::Color &color)
+bool GouraudShader::fragment(int, int, const float *varyings, sf::Color &color)
 {
-    float illumination = barycentric * varying_illumination;
-    const float texture_x = texture_triangle.scale_barycentric(VectorComponent::X, barycentric) * texture_width,
-                texture_y = texture_triangle.scale_barycentric(VectorComponent::Y, barycentric) * texture_height;
+    const float illumination = varyings[ILLUMINATION];
 
-    color = model.diffuse_map.getPixel(texture_x, texture_y);
+    color = model.diffuse_map.getPixel(varyings[TEXTURE_X], varyings[TEXTURE_Y]);
     color.r *= illumination;
     color.g *= illumination;
     color.b *= illumination;
@@ -98,25 +147,25 @@ NormalShader::NormalShader(
                             diffuse_const(diffuse_const),
                             specular_const(specular_const) {}
 
+void NormalShader::begin_face(size_t) {}
+
 FloatVector NormalShader::vertex(size_t face_idx, size_t vertex_idx)
 {
-    const Triangle face = model.faces[face_idx];
-    texture_triangle = model.textures[face_idx];
-    return (transformation_mat * Matrix(face.at(vertex_idx))).to_vector();
+    set_texture_varyings(face_idx, vertex_idx);
+    return project(model.vertex(face_idx, vertex_idx), vertex_idx);
 }
 
-bool NormalShader::fragment(const FloatVector &barycentric, sf::Color &color)
+bool NormalShader::fragment(int, int, const float *varyings, sf::Color &color)
 {
-    const float texture_x = texture_triangle.scale_barycentric(VectorComponent::X, barycentric) * texture_width,
-                texture_y = texture_triangle.scale_barycentric(VectorComponent::Y, barycentric) * texture_height;
+    const float texture_x = varyings[TEXTURE_X], texture_y = varyings[TEXTURE_Y];
 
     color = model.diffuse_map.getPixel(texture_x, texture_y);
 
     const FloatVector normal = model.get_normal(texture_x, texture_y),
-                      transformed_normal = (before_viewport_tinv * Matrix(normal)).to_vector().normalize(),
-                      transformed_light = (before_viewport * Matrix(light)).to_vector().normalize(),
+                      transformed_normal = before_viewport_tinv.transform(normal).fast_normalize(),
+                      transformed_light = before_viewport.transform(light).fast_normalize(),
                       scaled_normal = transformed_normal * (transformed_light * transformed_normal * 2.f),
-                      reflected = (scaled_normal - transformed_light).normalize();
+                      reflected = (scaled_normal - transformed_light).fast_normalize();
 
     const float diffuse = std::max(0.f, transformed_normal * transformed_light),
                 specular = std::pow(std::max(0.f, reflected.z), model.get_specular(texture_x, texture_y)),
@@ -127,3 +176,101 @@ bool NormalShader::fragment(const FloatVector &barycentric, sf::Color &color)
 
     return false;
 }
+
+FloatVector DepthShader::vertex(size_t face_idx, size_t vertex_idx)
+{
+    return project(model.vertex(face_idx, vertex_idx), vertex_idx);
+}
+
+bool DepthShader::fragment(int, int, const float *, sf::Color &)
+{
+    return false;
+}
+
+MultiLightShader::MultiLightShader(
+    const Model &model,
+    const Matrix &model_mat,
+    const Matrix &view_mat,
+    const Matrix &proj_mat,
+    const Matrix &viewport_mat,
+    const std::vector<Light> &lights,
+    const LightGrid &light_grid,
+    const FloatVector &eye,
+    float ambient_const,
+    float diffuse_const,
+    float specular_const) : Shader(model, model_mat, view_mat, proj_mat, viewport_mat, N_VARYINGS),
+                            lights(lights),
+                            light_grid(light_grid),
+                            normal_mat(model_mat.inv().T()),
+                            eye(eye),
+                            ambient_const(ambient_const),
+                            diffuse_const(diffuse_const),
+                            specular_const(specular_const),
+                            texture_width(model.diffuse_map.getSize().x),
+                            texture_height(model.diffuse_map.getSize().y) {}
+
+FloatVector MultiLightShader::vertex(size_t face_idx, size_t vertex_idx)
+{
+    const FloatVector position = model.vertex(face_idx, vertex_idx),
+                      texture = model.texture(face_idx).at(vertex_idx),
+                      world_position = model_mat.transform(position);
+
+    float *outputs = varying_values[vertex_idx];
+    outputs[TEXTURE_X] = texture.x * texture_width;
+    outputs[TEXTURE_Y] = texture.y * texture_height;
+    outputs[WORLD_X] = world_position.x;
+    outputs[WORLD_Y] = world_position.y;
+    outputs[WORLD_Z] = world_position.z;
+
+    return project(position, vertex_idx);
+}
+
+bool MultiLightShader::fragment(int x, int y, const float *varyings, sf::Color &color)
+{
+    const float texture_x = varyings[TEXTURE_X], texture_y = varyings[TEXTURE_Y];
+
+    color = model.diffuse_map.getPixel(texture_x, texture_y);
+
+    const FloatVector world_position(varyings[WORLD_X], varyings[WORLD_Y], varyings[WORLD_Z]);
+    const FloatVector normal = normal_mat.transform_direction(model.get_normal(texture_x, texture_y)).fast_normalize(),
+                      view_dir = (eye - world_position).fast_normalize();
+    const float shininess = model.get_specular(texture_x, texture_y);
+
+    FloatVector illumination;
+    auto add_light = [&](size_t light_idx)
+    {
+        const Light &light = lights[light_idx];
+
+        float attenuation = 0.f;
+        const FloatVector incident = light.incident(world_position, attenuation);
+        const float n_dot_l = normal * incident;
+        if (attenuation <= 0.f || n_dot_l <= 0.f)
+        {
+            return;
+        }
+
+        const FloatVector reflected = normal * (n_dot_l * 2.f) - incident;
+        const float specular = std::pow(std::max(0.f, reflected * view_dir), shininess),
+                    strength = attenuation * (diffuse_const * n_dot_l + specular_const * specular);
+        illumination = illumination + FloatVector(
+                                          light.color.x * strength,
+                                          light.color.y * strength,
+                                          light.color.z * strength);
+    };
+
+    for (const size_t light_idx : light_grid.global())
+    {
+        add_light(light_idx);
+    }
+
+    for (const size_t light_idx : light_grid.tile(x, y))
+    {
+        add_light(light_idx);
+    }
+
+    color.r = std::min(255.f, ambient_const + illumination.x * color.r);
+    color.g = std::min(255.f, ambient_const + illumination.y * color.g);
+    color.b = std::min(255.f, ambient_const + illumination.z * color.b);
+
+    return false;
+}
@@ -3,25 +3,49 @@
 
 #include <SFML/Graphics.hpp>
 
+#include <vector>
+
 #include "math/linalg.hpp"
+#include "rendering/lighting.hpp"
 #include "rendering/model.hpp"
 
+// Most floats a shader can pass from the vertex stage to the fragment stage
+const size_t max_varyings = 8;
+
 class Shader
 {
 protected:
     const Model &model;
     const Matrix model_mat, view_mat, proj_mat, viewport_mat, transformation_mat;
 
+    // Written by vertex() for each of the three vertices of the current face
+    const size_t n_varyings;
+    float varying_values[3][max_varyings];
+    float inverse_w[3];
+
+    // Transforms the position to the screen, remembering 1/w of the vertex for perspective correction
+    FloatVector project(const FloatVector &position, size_t vertex_idx);
+
 public:
     Shader(
         const Model &model,
         const Matrix &model_mat,
         const Matrix &view_mat,
         const Matrix &proj_mat,
-        const Matrix &viewport_mat);
+        const Matrix &viewport_mat,
+        size_t n_varyings = 0);
+
+    size_t varying_count() const;
+    const float *vertex_varyings(size_t vertex_idx) const;
+    float vertex_inverse_w(size_t vertex_idx) const;
+
+    // Called once per face before vertex() runs for its three vertices, for state that only depends on the face
+    virtual void begin_face(size_t face_idx);
 
     virtual FloatVector vertex(size_t face_idx, size_t vertex_idx) = 0;
-    virtual bool fragment(const FloatVector &barycentric, sf::Color &color) = 0;
+
+    // Gets the varyings of the last three vertices, interpolated perspective correctly at the pixel
+    virtual bool fragment(int x, int y, const float *varyings, sf::Color &color) = 0;
 };
 
 class SimpleShader : public Shader
@@ -30,10 +54,18 @@ private:
     float face_illumination;
 
 protected:
+    enum Varying
+    {
+        TEXTURE_X,
+        TEXTURE_Y,
+        N_VARYINGS
+    };
+
     const FloatVector light;
     const int texture_width, texture_height;
 
-    Triangle texture_triangle;
+    // Writes the texture coordinates of the vertex into its varyings
+    void set_texture_varyings(size_t face_idx, size_t vertex_idx);
 
 public:
     SimpleShader(
@@ -42,22 +74,36 @@ public:
         const Matrix &view_mat,
         const Matrix &proj_mat,
         const Matrix &viewport_mat,
-        const FloatVector &light);
+        const FloatVector &light,
+        size_t n_varyings = N_VARYINGS);
 
+    virtual void begin_face(size_t face_idx);
     virtual FloatVector vertex(size_t face_idx, size_t vertex_idx);
-    virtual bool fragment(const FloatVector &barycentric, sf::Color &color);
+    virtual bool fragment(int x, int y, const float *varyings, sf::Color &color);
 };
 
 class GouraudShader : public SimpleShader
 {
 private:
-    FloatVector varying_illumination;
+    enum Varying
+    {
+        ILLUMINATION = SimpleShader::N_VARYINGS,
+        N_VARYINGS
+    };
 
 public:
-    using SimpleShader::SimpleShader;
+    GouraudShader(
+        const Model &model,
+        const Matrix &model_mat,
+        const Matrix &view_mat,
+        const Matrix &proj_mat,
+        const Matrix &viewport_mat,
+        const FloatVector &light);
 
+    // Lit per vertex, the flat illumination of SimpleShader is not needed
+    void begin_face(size_t face_idx);
     FloatVector vertex(size_t face_idx, size_t vertex_idx);
-    bool fragment(const FloatVector &barycentric, sf::Color &color);
+    bool fragment(int x, int y, const float *varyings, sf::Color &color);
 };
 
 class NormalShader : public SimpleShader
@@ -78,8 +124,60 @@ public:
         float diffuse_const = 1.2f,
         float specular_const = .6f);
 
+    // Lit per pixel, the flat illumination of SimpleShader is not needed
+    void begin_face(size_t face_idx);
+    FloatVector vertex(size_t face_idx, size_t vertex_idx);
+    bool fragment(int x, int y, const float *varyings, sf::Color &color);
+};
+
+// Only transforms the vertices, used for depth pre-passes
+class DepthShader : public Shader
+{
+public:
+    using Shader::Shader;
+
+    FloatVector vertex(size_t face_idx, size_t vertex_idx);
+    bool fragment(int x, int y, const float *varyings, sf::Color &color);
+};
+
+// Normal mapped Phong shading with any number of lights, only the lights binned
+// into the tile of the pixel are evaluated
+class MultiLightShader : public Shader
+{
+private:
+    const std::vector<Light> &lights;
+    const LightGrid &light_grid;
+    const Matrix normal_mat;
+    const FloatVector eye;
+    const float ambient_const, diffuse_const, specular_const;
+    const int texture_width, texture_height;
+
+    enum Varying
+    {
+        TEXTURE_X,
+        TEXTURE_Y,
+        WORLD_X,
+        WORLD_Y,
+        WORLD_Z,
+        N_VARYINGS
+    };
+
+public:
+    MultiLightShader(
+        const Model &model,
+        const Matrix &model_mat,
+        const Matrix &view_mat,
+        const Matrix &proj_mat,
+        const Matrix &viewport_mat,
+        const std::vector<Light> &lights,
+        const LightGrid &light_grid,
+        const FloatVector &eye,
+        float ambient_const = 3.f,
+        float diffuse_const = 1.2f,
+        float specular_const = .6f);
+
     FloatVector vertex(size_t face_idx, size_t vertex_idx);
-    bool fragment(const FloatVector &barycentric, sf::Color &color);
+    bool fragment(int x, int y, const float *varyings, sf::Color &color);
 };
 
 #endif
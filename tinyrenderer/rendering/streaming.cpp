@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#include "math/triangle.hpp"
+#include "rendering/draw.hpp"
+#include "rendering/streaming.hpp"
+
+const std::uint32_t chunked_mesh_magic = 0x4b484354; // "TCHK"
+const std::uint32_t chunked_mesh_version = 1;
+
+ChunkedMesh::ChunkedMesh(const std::string &filename) : filename(filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to open the chunked mesh");
+    }
+
+    std::uint32_t magic = 0, version = 0;
+    std::uint64_t table_offset = 0, n_chunks = 0;
+    file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&table_offset), sizeof(table_offset));
+    if (magic != chunked_mesh_magic || version != chunked_mesh_version)
+    {
+        throw std::runtime_error("Not a chunked mesh file");
+    }
+
+    // The chunks lie between the header and the table, the count is checked against the rest of the file before
+    // the table is allocated
+    const std::uint64_t header_bytes = sizeof(magic) + sizeof(version) + sizeof(table_offset);
+    file.seekg(table_offset);
+    file.read(reinterpret_cast<char *>(&n_chunks), sizeof(n_chunks));
+    if (file.fail() || table_offset < header_bytes || n_chunks > remaining_stream_bytes(file) / sizeof(ChunkInfo))
+    {
+        throw std::runtime_error("Corrupt chunked mesh file");
+    }
+
+    chunk_table.resize(n_chunks);
+    file.read(reinterpret_cast<char *>(chunk_table.data()), n_chunks * sizeof(ChunkInfo));
+    if (file.fail())
+    {
+        throw std::runtime_error("Truncated chunked mesh file");
+    }
+
+    // The memory size is what the streaming budget is accounted in, and NaN bounds would break the depth sort
+    for (const ChunkInfo &chunk : chunk_table)
+    {
+        if (chunk.offset < header_bytes || chunk.offset > table_offset ||
+            chunk.payload_bytes > table_offset - chunk.offset || chunk.memory_bytes == 0 ||
+            !chunk.bounds_min.is_finite() || !chunk.bounds_max.is_finite())
+        {
+            throw std::runtime_error("Corrupt chunked mesh file");
+        }
+    }
+}
+
+const std::vector<ChunkInfo> &ChunkedMesh::chunks() const
+{
+    return chunk_table;
+}
+
+CompactMesh ChunkedMesh::load_chunk(size_t chunk_idx) const
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to open the chunked mesh");
+    }
+
+    file.seekg(chunk_table.at(chunk_idx).offset);
+
+    CompactMesh chunk;
+    chunk.load(file);
+    return chunk;
+}
+
+void write_triangle(std::ostream &stream, const Triangle &triangle)
+{
+    stream.write(reinterpret_cast<const char *>(&triangle), sizeof(Triangle));
+}
+
+bool read_triangle(std::istream &stream, Triangle &triangle)
+{
+    return static_cast<bool>(stream.read(reinterpret_cast<char *>(&triangle), sizeof(Triangle)));
+}
+
+// Upper estimate of what a face costs while its chunk is built: the float triangles, and a packed vertex,
+// an index and a node of the vertex map of CompactMesh for each corner
+const size_t chunk_build_bytes_per_face = 3 * sizeof(Triangle) + 3 * (sizeof(PackedVertex) + sizeof(std::uint32_t) + 96);
+
+// Removes the temporary files of a build once it is done, also when it fails halfway
+class TemporaryFiles
+{
+private:
+    std::vector<std::string> filenames;
+
+public:
+    TemporaryFiles() {}
+    ~TemporaryFiles()
+    {
+        for (const auto &filename : filenames)
+        {
+            std::remove(filename.c_str());
+        }
+    }
+
+    TemporaryFiles(const TemporaryFiles &) = delete;
+    TemporaryFiles &operator=(const TemporaryFiles &) = delete;
+
+    std::string add(const std::string &filename)
+    {
+        filenames.push_back(filename);
+        return filenames.back();
+    }
+};
+
+// Reads the vectors [begin, end) of a file written by the first pass of the build
+std::vector<FloatVector> read_vector_slice(const std::string &filename, size_t begin, size_t end)
+{
+    std::vector<FloatVector> slice(end - begin);
+    std::ifstream file(filename, std::ios::binary);
+    file.seekg(begin * sizeof(FloatVector));
+    file.read(reinterpret_cast<char *>(slice.data()), slice.size() * sizeof(FloatVector));
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to read a temporary vector file");
+    }
+
+    return slice;
+}
+
+void ChunkedMesh::build(
+    const std::string &model_filename,
+    const std::string &chunk_filename,
+    size_t max_chunk_faces,
+    size_t memory_budget,
+    size_t grid_size)
+{
+    // The first pass spills the vectors and the face indices of the OBJ into temporary files, indexed by their
+    // position in the file, so no record of the model is ever kept in memory. The files are removed as soon as
+    // they are used up, the rest when the build ends.
+    TemporaryFiles temporary_files;
+    const std::string vector_filenames[] = {
+        temporary_files.add(chunk_filename + ".vertices"),
+        temporary_files.add(chunk_filename + ".textures"),
+        temporary_files.add(chunk_filename + ".normals")};
+    const std::string indices_filename = temporary_files.add(chunk_filename + ".indices");
+
+    size_t n_vectors[3] = {0, 0, 0}, n_faces = 0;
+    {
+        std::ofstream vector_files[3], indices_file(indices_filename, std::ios::binary);
+        for (size_t type = 0; type < 3; ++type)
+        {
+            vector_files[type].open(vector_filenames[type], std::ios::binary);
+        }
+
+        read_wavefront_records(
+            model_filename,
+            [&](WavefrontVectorType type, const FloatVector &vec)
+            {
+                vector_files[type].write(reinterpret_cast<const char *>(&vec), sizeof(FloatVector));
+                ++n_vectors[type];
+            },
+            [&](const IntVector &face, const IntVector &texture, const IntVector &normal)
+            {
+                // Faces only refer to the vectors defined before them
+                const IntVector face_indices[] = {face, texture, normal};
+                for (size_t type = 0; type < 3; ++type)
+                {
+                    for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+                    {
+                        if (face_indices[type].at(i) < 0 || static_cast<size_t>(face_indices[type].at(i)) >= n_vectors[type])
+                        {
+                            throw std::runtime_error("Invalid face index in the model");
+                        }
+                    }
+                }
+
+                indices_file.write(reinterpret_cast<const char *>(face_indices), sizeof(face_indices));
+                ++n_faces;
+            });
+
+        bool failed = indices_file.fail();
+        for (const auto &vector_file : vector_files)
+        {
+            failed = failed || vector_file.fail();
+        }
+
+        if (failed)
+        {
+            throw std::runtime_error("Failed to write the temporary files of the build");
+        }
+    }
+
+    // The faces are resolved slice by slice of the vector index range, a slice of all three vector files fits into
+    // the memory budget. Every slice pass streams the indices and the partially resolved faces of the previous pass,
+    // and fills in the corners that refer to the slice. The last pass also finds the bounds of the face centroids,
+    // which define the bucket grid.
+    const size_t slice_size = std::max<size_t>(1, memory_budget / (3 * sizeof(FloatVector))),
+                 max_vectors = std::max(n_vectors[WAVEFRONT_VERTEX], std::max(n_vectors[WAVEFRONT_TEXTURE], n_vectors[WAVEFRONT_NORMAL])),
+                 n_slices = std::max<size_t>(1, (max_vectors + slice_size - 1) / slice_size);
+    const std::string resolved_filenames[] = {
+        temporary_files.add(chunk_filename + ".resolved0"),
+        temporary_files.add(chunk_filename + ".resolved1")};
+
+    FloatVector centroid_min(
+        std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::max()),
+        centroid_max = centroid_min * -1.f;
+    for (size_t slice_idx = 0; slice_idx < n_slices; ++slice_idx)
+    {
+        const size_t begin = slice_idx * slice_size;
+        std::vector<FloatVector> slices[3];
+        for (size_t type = 0; type < 3; ++type)
+        {
+            const size_t end = std::min(n_vectors[type], begin + slice_size);
+            if (begin < end)
+            {
+                slices[type] = read_vector_slice(vector_filenames[type], begin, end);
+            }
+        }
+
+        std::ifstream indices_file(indices_filename, std::ios::binary), previous;
+        if (slice_idx > 0)
+        {
+            previous.open(resolved_filenames[(slice_idx + 1) % 2], std::ios::binary);
+        }
+
+        std::ofstream resolved(resolved_filenames[slice_idx % 2], std::ios::binary);
+        if (indices_file.fail() || resolved.fail() || previous.fail())
+        {
+            throw std::runtime_error("Failed to open the temporary files of the build");
+        }
+
+        for (size_t face_idx = 0; face_idx < n_faces; ++face_idx)
+        {
+            IntVector face_indices[3];
+            Triangle triangles[3];
+            indices_file.read(reinterpret_cast<char *>(face_indices), sizeof(face_indices));
+            if (slice_idx > 0)
+            {
+                for (auto &triangle : triangles)
+                {
+                    read_triangle(previous, triangle);
+                }
+            }
+
+            for (size_t type = 0; type < 3; ++type)
+            {
+                for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+                {
+                    const size_t vector_idx = face_indices[type].at(vertex_idx);
+                    if (vector_idx >= begin && vector_idx - begin < slices[type].size())
+                    {
+                        triangles[type][vertex_idx] = slices[type][vector_idx - begin];
+                    }
+                }
+            }
+
+            if (slice_idx + 1 == n_slices)
+            {
+                const Triangle &face = triangles[0];
+                const FloatVector centroid = (face.p0 + face.p1 + face.p2) * (1.f / 3.f);
+                for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+                {
+                    centroid_min[i] = std::min(centroid_min[i], centroid.at(i));
+                    centroid_max[i] = std::max(centroid_max[i], centroid.at(i));
+                }
+            }
+
+            for (const auto &triangle : triangles)
+            {
+                write_triangle(resolved, triangle);
+            }
+        }
+
+        if (indices_file.fail() || previous.fail() || resolved.fail())
+        {
+            throw std::runtime_error("Failed to resolve the faces");
+        }
+    }
+
+    for (const auto &filename : vector_filenames)
+    {
+        std::remove(filename.c_str());
+    }
+
+    std::remove(indices_filename.c_str());
+    std::remove(resolved_filenames[n_slices % 2].c_str());
+    const std::string &resolved_filename = resolved_filenames[(n_slices + 1) % 2];
+
+    const size_t n_buckets = grid_size * grid_size * grid_size;
+    std::vector<std::string> bucket_filenames(n_buckets);
+    std::vector<std::ofstream> buckets(n_buckets);
+    for (size_t bucket_idx = 0; bucket_idx < n_buckets; ++bucket_idx)
+    {
+        bucket_filenames[bucket_idx] = temporary_files.add(chunk_filename + ".bucket" + std::to_string(bucket_idx));
+        buckets[bucket_idx].open(bucket_filenames[bucket_idx], std::ios::binary);
+        if (buckets[bucket_idx].fail())
+        {
+            throw std::runtime_error("Failed to create a temporary bucket file");
+        }
+    }
+
+    const FloatVector extent = centroid_max - centroid_min;
+    {
+        std::ifstream resolved(resolved_filename, std::ios::binary);
+        Triangle face, texture, normal;
+        while (read_triangle(resolved, face) && read_triangle(resolved, texture) && read_triangle(resolved, normal))
+        {
+            const FloatVector centroid = (face.p0 + face.p1 + face.p2) * (1.f / 3.f);
+            size_t bucket_idx = 0;
+            for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+            {
+                const float relative = extent.at(i) > 0.f ? (centroid.at(i) - centroid_min.at(i)) / extent.at(i) : 0.f;
+                const size_t cell = std::min(grid_size - 1, static_cast<size_t>(relative * grid_size));
+                bucket_idx = bucket_idx * grid_size + cell;
+            }
+
+            write_triangle(buckets[bucket_idx], face);
+            write_triangle(buckets[bucket_idx], texture);
+            write_triangle(buckets[bucket_idx], normal);
+        }
+    }
+
+    std::remove(resolved_filename.c_str());
+
+    // A chunk is built in memory, so it has to fit into the budget as well
+    max_chunk_faces = std::max<size_t>(1, std::min(max_chunk_faces, memory_budget / chunk_build_bytes_per_face));
+
+    for (auto &bucket : buckets)
+    {
+        bucket.close();
+    }
+
+    std::ofstream file(chunk_filename, std::ios::binary);
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to create the chunked mesh");
+    }
+
+    // The table offset is filled in once all the chunks are written
+    std::uint64_t table_offset = 0;
+    file.write(reinterpret_cast<const char *>(&chunked_mesh_magic), sizeof(chunked_mesh_magic));
+    file.write(reinterpret_cast<const char *>(&chunked_mesh_version), sizeof(chunked_mesh_version));
+    file.write(reinterpret_cast<const char *>(&table_offset), sizeof(table_offset));
+
+    std::vector<ChunkInfo> chunk_table;
+    std::vector<Triangle> faces, textures, normals;
+    for (const auto &bucket_filename : bucket_filenames)
+    {
+        std::ifstream bucket(bucket_filename, std::ios::binary);
+        bool bucket_done = false;
+        while (!bucket_done)
+        {
+            faces.clear();
+            textures.clear();
+            normals.clear();
+
+            Triangle face, texture, normal;
+            while (faces.size() < max_chunk_faces)
+            {
+                if (!read_triangle(bucket, face) || !read_triangle(bucket, texture) || !read_triangle(bucket, normal))
+                {
+                    bucket_done = true;
+                    break;
+                }
+
+                faces.push_back(face);
+                textures.push_back(texture);
+                normals.push_back(normal);
+            }
+
+            if (faces.empty())
+            {
+                continue;
+            }
+
+            ChunkInfo info;
+            info.n_faces = faces.size();
+            info.bounds_min = info.bounds_max = faces[0].p0;
+            for (const auto &chunk_face : faces)
+            {
+                for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+                {
+                    for (size_t i = VectorComponent::X; i <= VectorComponent::Z; ++i)
+                    {
+                        info.bounds_min[i] = std::min(info.bounds_min[i], chunk_face.at(vertex_idx).at(i));
+                        info.bounds_max[i] = std::max(info.bounds_max[i], chunk_face.at(vertex_idx).at(i));
+                    }
+                }
+            }
+
+            const CompactMesh chunk(faces, textures, normals);
+            info.offset = file.tellp();
+            chunk.save(file);
+            info.payload_bytes = static_cast<std::uint64_t>(file.tellp()) - info.offset;
+            info.memory_bytes = chunk.memory_usage();
+            chunk_table.push_back(info);
+        }
+
+        bucket.close();
+        std::remove(bucket_filename.c_str());
+    }
+
+    table_offset = file.tellp();
+    const std::uint64_t n_chunks = chunk_table.size();
+    file.write(reinterpret_cast<const char *>(&n_chunks), sizeof(n_chunks));
+    file.write(reinterpret_cast<const char *>(chunk_table.data()), n_chunks * sizeof(ChunkInfo));
+
+    file.seekp(sizeof(chunked_mesh_magic) + sizeof(chunked_mesh_version));
+    file.write(reinterpret_cast<const char *>(&table_offset), sizeof(table_offset));
+    if (file.fail())
+    {
+        throw std::runtime_error("Failed to write the chunked mesh");
+    }
+}
+
+StreamingStats::StreamingStats() : n_chunks(0), n_culled(0), n_prefetched(0), peak_resident_bytes(0) {}
+
+// Conservative: the chunk is only culled if its whole bounding box is on one side of the screen
+bool chunk_outside_screen(const ChunkInfo &chunk, const Matrix &model_to_screen, int screen_width, int screen_height)
+{
+    int outside_left = 0, outside_right = 0, outside_bottom = 0, outside_top = 0;
+    for (size_t corner = 0; corner < 8; ++corner)
+    {
+        const FloatVector point(
+            corner & 1 ? chunk.bounds_max.x : chunk.bounds_min.x,
+            corner & 2 ? chunk.bounds_max.y : chunk.bounds_min.y,
+            corner & 4 ? chunk.bounds_max.z : chunk.bounds_min.z);
+        const Matrix projected = model_to_screen * Matrix(point);
+        if (projected.at(VectorComponent::W)[0] <= 0.f)
+        {
+            return false;
+        }
+
+        const FloatVector screen = projected.to_vector();
+        outside_left += screen.x < 0.f;
+        outside_right += screen.x >= screen_width;
+        outside_bottom += screen.y < 0.f;
+        outside_top += screen.y >= screen_height;
+    }
+
+    return outside_left == 8 || outside_right == 8 || outside_bottom == 8 || outside_top == 8;
+}
+
+StreamingStats draw_streamed(
+    sf::Image &screen,
+    std::vector<std::vector<float>> &zbuf,
+    Model &model,
+    Shader &shader,
+    const ChunkedMesh &mesh,
+    const Matrix &model_to_screen,
+    const FloatVector &eye,
+    size_t memory_budget,
+    size_t partition_idx,
+    size_t n_partitions)
+{
+    const auto &chunks = mesh.chunks();
+    const auto screen_size = screen.getSize();
+
+    StreamingStats stats;
+
+    std::vector<size_t> visible;
+    std::vector<float> distances(chunks.size());
+    for (size_t chunk_idx = partition_idx; chunk_idx < chunks.size(); chunk_idx += n_partitions)
+    {
+        ++stats.n_chunks;
+        if (chunk_outside_screen(chunks[chunk_idx], model_to_screen, screen_size.x, screen_size.y))
+        {
+            ++stats.n_culled;
+            continue;
+        }
+
+        if (chunks[chunk_idx].memory_bytes > memory_budget)
+        {
+            throw std::runtime_error("A chunk does not fit into the memory budget");
+        }
+
+        const FloatVector to_eye = (chunks[chunk_idx].bounds_min + chunks[chunk_idx].bounds_max) * .5f - eye;
+        distances[chunk_idx] = to_eye * to_eye;
+        visible.push_back(chunk_idx);
+    }
+
+    std::stable_sort(
+        visible.begin(),
+        visible.end(),
+        [&distances](size_t lhs, size_t rhs)
+        { return distances[lhs] < distances[rhs]; });
+
+    std::future<CompactMesh> next_chunk;
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+        const ChunkInfo &chunk = chunks[visible[i]];
+
+        // A prefetched chunk was already counted together with the previous one, otherwise
+        // the previous chunk is released before the current one is read
+        if (next_chunk.valid())
+        {
+            model.compact_mesh = next_chunk.get();
+        }
+        else
+        {
+            model.compact_mesh = CompactMesh();
+            model.compact_mesh = mesh.load_chunk(visible[i]);
+        }
+
+        model.is_compact = true;
+
+        size_t resident_bytes = chunk.memory_bytes;
+        if (i + 1 < visible.size() && resident_bytes + chunks[visible[i + 1]].memory_bytes <= memory_budget)
+        {
+            resident_bytes += chunks[visible[i + 1]].memory_bytes;
+            next_chunk = std::async(std::launch::async, &ChunkedMesh::load_chunk, &mesh, visible[i + 1]);
+            ++stats.n_prefetched;
+        }
+
+        stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, resident_bytes);
+
+        for (size_t face_idx = 0; face_idx < model.n_faces(); ++face_idx)
+        {
+            Triangle screen_coords;
+            shader.begin_face(face_idx);
+            for (size_t vertex_idx = 0; vertex_idx < 3; ++vertex_idx)
+            {
+                screen_coords[vertex_idx] = shader.vertex(face_idx, vertex_idx);
+            }
+
+            draw_triangle(screen, screen_coords, zbuf, shader);
+        }
+    }
+
+    model.compact_mesh = CompactMesh();
+    return stats;
+}
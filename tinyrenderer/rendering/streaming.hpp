@@ -0,0 +1,73 @@
+#ifndef __STREAMING_HPP__
+#define __STREAMING_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "math/linalg.hpp"
+#include "rendering/compact_mesh.hpp"
+#include "rendering/model.hpp"
+#include "rendering/shader.hpp"
+
+struct ChunkInfo
+{
+    std::uint64_t offset, payload_bytes, memory_bytes, n_faces;
+    FloatVector bounds_min, bounds_max;
+};
+
+// A mesh split into spatially coherent compact chunks stored in one file.
+// Only the chunk table is kept in memory, the chunks are read on demand.
+class ChunkedMesh
+{
+private:
+    std::string filename;
+    std::vector<ChunkInfo> chunk_table;
+
+public:
+    explicit ChunkedMesh(const std::string &filename);
+
+    const std::vector<ChunkInfo> &chunks() const;
+
+    // Opens its own stream, so chunks can be loaded from several threads
+    CompactMesh load_chunk(size_t chunk_idx) const;
+
+    // Splits a Wavefront file into chunks of at most max_chunk_faces faces, without ever holding more than
+    // memory_budget bytes of the model. The vectors and the faces are spilled into temporary files next to the
+    // output, the faces are resolved against slices of the vectors that fit into the budget and then bucketed by
+    // their centroid on a grid_size^3 grid. Chunks are capped to what fits into the budget while they are built.
+    static void build(
+        const std::string &model_filename,
+        const std::string &chunk_filename,
+        size_t max_chunk_faces = 65536,
+        size_t memory_budget = 64 << 20,
+        size_t grid_size = 4);
+};
+
+struct StreamingStats
+{
+    size_t n_chunks, n_culled, n_prefetched, peak_resident_bytes;
+
+    StreamingStats();
+};
+
+// Draws the chunks that can be visible, front to back, into the shared z-buffer. The chunks are swapped into the
+// model one at a time, so the shader has to be built for this model. The next chunk is read on another thread
+// while the current one is drawn, as long as both fit into the memory budget together.
+// Only the chunks of the partition are drawn: those whose index is partition_idx modulo n_partitions, which spreads
+// the neighbouring chunks of the grid over all partitions.
+StreamingStats draw_streamed(
+    sf::Image &screen,
+    std::vector<std::vector<float>> &zbuf,
+    Model &model,
+    Shader &shader,
+    const ChunkedMesh &mesh,
+    const Matrix &model_to_screen,
+    const FloatVector &eye,
+    size_t memory_budget,
+    size_t partition_idx = 0,
+    size_t n_partitions = 1);
+
+#endif
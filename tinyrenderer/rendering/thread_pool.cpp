@@ -0,0 +1,140 @@
+#include <algorithm>
+
+#include "rendering/thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t n_threads) : job(nullptr),
+                                           kernel(nullptr),
+                                           n_rows(0),
+                                           band_size(0),
+                                           pass_idx(0),
+                                           n_running(0),
+                                           stopping(false)
+{
+    if (n_threads == 0)
+    {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers.reserve(n_threads - 1);
+    for (size_t band_idx = 1; band_idx < n_threads; ++band_idx)
+    {
+        workers.emplace_back(&ThreadPool::run_worker, this, band_idx);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    pass_started.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const
+{
+    return workers.size() + 1;
+}
+
+size_t ThreadPool::band_count(int n_rows) const
+{
+    return std::max<size_t>(1, std::min<size_t>(size(), std::max(0, n_rows)));
+}
+
+void ThreadPool::run_worker(size_t band_idx)
+{
+    size_t last_pass_idx = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        pass_started.wait(lock, [&]() { return stopping || pass_idx != last_pass_idx; });
+        if (stopping)
+        {
+            return;
+        }
+
+        last_pass_idx = pass_idx;
+        const int begin = std::min<size_t>(n_rows, band_idx * band_size), end = std::min(n_rows, begin + band_size);
+        lock.unlock();
+
+        // Caught, an exception escaping the thread would terminate the process
+        std::exception_ptr error;
+        if (begin < end)
+        {
+            try
+            {
+                job(kernel, band_idx, begin, end);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        }
+
+        lock.lock();
+        if (error && !failure)
+        {
+            failure = error;
+        }
+
+        if (--n_running == 0)
+        {
+            pass_finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_pass(BandJob job, const void *kernel, int n_rows)
+{
+    const size_t n_bands = band_count(n_rows);
+    const int band_size = (n_rows + n_bands - 1) / n_bands;
+    if (n_bands == 1)
+    {
+        job(kernel, 0, 0, n_rows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = job;
+        this->kernel = kernel;
+        this->n_rows = n_rows;
+        this->band_size = band_size;
+        n_running = workers.size();
+        ++pass_idx;
+    }
+
+    pass_started.notify_all();
+
+    // The workers hold on to the kernel, so they are waited for even if the first band throws
+    std::exception_ptr error;
+    try
+    {
+        job(kernel, 0, 0, band_size);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        pass_finished.wait(lock, [&]() { return n_running == 0; });
+        if (!error)
+        {
+            error = failure;
+        }
+
+        failure = nullptr;
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Workers that are started once and then split the rows of every pass into contiguous bands. The calling thread
+// takes the first band, so a pool of one thread runs everything inline. A pass neither starts threads nor allocates.
+class ThreadPool
+{
+private:
+    // Kernels are called through a plain function pointer, so no pass has to wrap them into a std::function
+    typedef void (*BandJob)(const void *kernel, size_t band_idx, int begin, int end);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable pass_started, pass_finished;
+
+    BandJob job;
+    const void *kernel;
+    int n_rows, band_size;
+
+    // Every pass gets a new index, the workers run once per index
+    size_t pass_idx, n_running;
+    bool stopping;
+
+    // First exception thrown by a worker during the current pass
+    std::exception_ptr failure;
+
+    void run_worker(size_t band_idx);
+    void run_pass(BandJob job, const void *kernel, int n_rows);
+
+public:
+    // The calling thread counts as one of the threads, 0 uses every hardware thread
+    explicit ThreadPool(size_t n_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const;
+
+    // Number of bands the rows are split into, at most one per thread
+    size_t band_count(int n_rows) const;
+
+    // Calls kernel(band_idx, begin, end) for every band and returns once all of them are done.
+    // The band index lets the kernel use scratch memory that was set aside for it. If bands throw, the first
+    // exception is rethrown once all of them are done, the one of the calling thread's band takes precedence.
+    template <typename RowKernel>
+    void parallel_rows(int n_rows, const RowKernel &kernel)
+    {
+        run_pass(
+            [](const void *kernel, size_t band_idx, int begin, int end)
+            {
+                (*static_cast<const RowKernel *>(kernel))(band_idx, begin, end);
+            },
+            &kernel,
+            n_rows);
+    }
+};
+
+#endif
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "rendering/draw.hpp"
+#include "rendering/model_loader.hpp"
+#include "rendering/shader.hpp"
+#include "server/render_server.hpp"
+
+// Largest width and height of a request, so that one line cannot make the server allocate gigabytes of buffers
+const int max_request_side = 8192;
+
+FloatVector parse_vector(const std::string &value)
+{
+    std::istringstream iss(value);
+    FloatVector vec;
+    char comma_x = 0, comma_y = 0;
+    iss >> vec.x >> comma_x >> vec.y >> comma_y >> vec.z;
+    if (iss.fail() || comma_x != ',' || comma_y != ',')
+    {
+        throw std::runtime_error("Invalid vector " + value);
+    }
+
+    return vec;
+}
+
+RenderRequest::RenderRequest() : model_filename("model/model.obj"),
+                                 normal_map_filename("model/normal_map.png"),
+                                 specular_map_filename("model/specular_map.png"),
+                                 diffuse_map_filename("model/diffuse_map.png"),
+                                 shader("normal"),
+                                 output("result.png"),
+                                 eye(1.f, 1.f, 3.f),
+                                 center(0.f, 0.f, 0.f),
+                                 up(0.f, 1.f, 0.f),
+                                 light(0.f, 0.f, 1.f),
+                                 width(1600),
+                                 height(1600) {}
+
+RenderRequest RenderRequest::parse(const std::string &line)
+{
+    RenderRequest request;
+
+    std::istringstream iss(line);
+    std::string token;
+    while (iss >> token)
+    {
+        const size_t separator = token.find('=');
+        if (separator == std::string::npos)
+        {
+            throw std::runtime_error("Expected key=value, got " + token);
+        }
+
+        const std::string key = token.substr(0, separator), value = token.substr(separator + 1);
+        if (key == "model")
+        {
+            request.model_filename = value;
+        }
+        else if (key == "normal_map")
+        {
+            request.normal_map_filename = value;
+        }
+        else if (key == "specular_map")
+        {
+            request.specular_map_filename = value;
+        }
+        else if (key == "diffuse_map")
+        {
+            request.diffuse_map_filename = value;
+        }
+        else if (key == "shader")
+        {
+            request.shader = value;
+        }
+        else if (key == "output")
+        {
+            request.output = value;
+        }
+        else if (key == "eye")
+        {
+            request.eye = parse_vector(value);
+        }
+        else if (key == "center")
+        {
+            request.center = parse_vector(value);
+        }
+        else if (key == "up")
+        {
+            request.up = parse_vector(value);
+        }
+        else if (key == "light")
+        {
+            request.light = parse_vector(value);
+        }
+        else if (key == "width")
+        {
+            request.width = std::stoi(value);
+        }
+        else if (key == "height")
+        {
+            request.height = std::stoi(value);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown key " + key);
+        }
+    }
+
+    if (request.width <= 0 || request.height <= 0 ||
+        request.width > max_request_side || request.height > max_request_side)
+    {
+        throw std::runtime_error("Invalid resolution");
+    }
+
+    return request;
+}
+
+std::string model_cache_key(const RenderRequest &request)
+{
+    return request.model_filename + '\n' +
+           request.normal_map_filename + '\n' +
+           request.specular_map_filename + '\n' +
+           request.diffuse_map_filename;
+}
+
+ModelCache::ModelCache(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+void ModelCache::insert(const std::string &key, const std::shared_ptr<const Model> &model)
+{
+    entries.emplace_front(key, model);
+    index[key] = entries.begin();
+    if (entries.size() > capacity)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+std::shared_ptr<const Model> ModelCache::get(const RenderRequest &request, bool &hit)
+{
+    const std::string key = model_cache_key(request);
+
+    const auto found = index.find(key);
+    hit = found != index.end();
+    if (hit)
+    {
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->second;
+    }
+
+    const ModelHandle loading(
+        request.model_filename,
+        request.normal_map_filename,
+        request.specular_map_filename,
+        request.diffuse_map_filename);
+    const std::shared_ptr<const Model> model = loading.share();
+
+    insert(key, model);
+    return model;
+}
+
+std::vector<std::string> ModelCache::preload(const std::vector<RenderRequest> &requests)
+{
+    std::vector<std::string> keys, problems;
+    std::vector<ModelFiles> files;
+    for (const RenderRequest &request : requests)
+    {
+        const std::string key = model_cache_key(request);
+        if (index.count(key) > 0 || std::find(keys.begin(), keys.end(), key) != keys.end())
+        {
+            continue;
+        }
+
+        if (keys.size() == capacity)
+        {
+            problems.push_back(request.model_filename + ": skipped, the cache only holds " + std::to_string(capacity) + " models");
+            continue;
+        }
+
+        keys.push_back(key);
+        files.push_back({request.model_filename,
+                         request.normal_map_filename,
+                         request.specular_map_filename,
+                         request.diffuse_map_filename});
+    }
+
+    // A model that fails to load is reported, the others are still cached
+    const std::vector<ModelHandle> handles = load_models(files);
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+        try
+        {
+            insert(keys[i], handles[i].share());
+        }
+        catch (const std::exception &e)
+        {
+            problems.push_back(files[i].model_filename + ": " + e.what());
+        }
+    }
+
+    return problems;
+}
+
+RenderServer::RenderServer(size_t model_cache_capacity) : models(model_cache_capacity) {}
+
+std::vector<std::string> RenderServer::preload(const std::vector<std::string> &model_filenames)
+{
+    std::vector<RenderRequest> requests(model_filenames.size());
+    for (size_t i = 0; i < model_filenames.size(); ++i)
+    {
+        requests[i].model_filename = model_filenames[i];
+    }
+
+    return models.preload(requests);
+}
+
+void RenderServer::prepare_framebuffers(int width, int height)
+{
+    const float background = -std::numeric_limits<float>::max();
+    const auto screen_size = screen.getSize();
+    if (screen_size.x != static_cast<unsigned>(width) || screen_size.y != static_cast<unsigned>(height))
+    {
+        // The z-buffer is built first and both buffers are dropped if the screen cannot be resized, so a failed
+        // allocation never leaves them at different sizes for the in-place clear below
+        std::vector<std::vector<float>> resized_zbuf(width, std::vector<float>(height, background));
+        try
+        {
+            screen.create(width, height, sf::Color::Black);
+        }
+        catch (...)
+        {
+            screen = sf::Image();
+            zbuf.clear();
+            throw;
+        }
+
+        zbuf.swap(resized_zbuf);
+        return;
+    }
+
+    // Same size as the last request: the buffers are cleared in place. The z-buffer tells which pixels the last
+    // request drew, only those are reset, since sf::Image can only be cleared as a whole by reallocating it.
+    for (int x = 0; x < width; ++x)
+    {
+        float *column = zbuf[x].data();
+        for (int y = 0; y < height; ++y)
+        {
+            if (column[y] != background)
+            {
+                screen.setPixel(x, y, sf::Color::Black);
+                column[y] = background;
+            }
+        }
+    }
+}
+
+void RenderServer::write_output(const std::string &output)
+{
+    // Images are written top row first, the screen is flipped back so that the next request can clear it
+    const std::string shm_prefix = "shm:";
+    if (output.compare(0, shm_prefix.size(), shm_prefix) != 0)
+    {
+        screen.flipVertically();
+        const bool saved = screen.saveToFile(output);
+        screen.flipVertically();
+        if (!saved)
+        {
+            throw std::runtime_error("Failed to save " + output);
+        }
+
+        return;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    const std::string name = output.substr(shm_prefix.size());
+    const auto screen_size = screen.getSize();
+    const size_t n_bytes = static_cast<size_t>(screen_size.x) * screen_size.y * 4;
+
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open shared memory " + name);
+    }
+
+    void *buffer = MAP_FAILED;
+    if (ftruncate(fd, n_bytes) == 0)
+    {
+        buffer = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+    if (buffer == MAP_FAILED)
+    {
+        throw std::runtime_error("Failed to map shared memory " + name);
+    }
+
+    // The rows are copied in reverse order instead of flipping the screen
+    const size_t row_bytes = static_cast<size_t>(screen_size.x) * 4;
+    for (size_t y = 0; y < screen_size.y; ++y)
+    {
+        std::memcpy(
+            static_cast<unsigned char *>(buffer) + y * row_bytes,
+            screen.getPixelsPtr() + (screen_size.y - 1 - y) * row_bytes,
+            row_bytes);
+    }
+
+    munmap(buffer, n_bytes);
+#else
+    throw std::runtime_error("Shared memory output is not supported on this platform");
+#endif
+}
+
+std::string RenderServer::handle(const std::string &line)
+{
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    const auto start_time = std::chrono::steady_clock::now();
+    allocations = RequestAllocations();
+
+    try
+    {
+        RenderRequest request;
+        bool cached = false;
+        std::shared_ptr<const Model> model;
+        {
+            const AllocationScope request_scope;
+            request = RenderRequest::parse(line);
+            model = models.get(request, cached);
+            allocations.request = request_scope.counts();
+        }
+
+        const AllocationScope setup_scope;
+        prepare_framebuffers(request.width, request.height);
+
+        const Matrix model_mat = Matrix::identity(4),
+                     view_mat = Matrix::look_at(request.eye, request.center, request.up),
+                     proj_mat = Matrix::projection((request.center - request.eye).norm()),
+                     viewport_mat = Matrix::viewport(
+                         request.width / 8,
+                         request.height / 8,
+                         request.width * 3 / 4,
+                         request.height * 3 / 4);
+
+        // The shaders are constructed on the stack, so the setup does not allocate
+        double raster_ms = 0.;
+        auto render = [&](Shader &shader)
+        {
+            allocations.setup = setup_scope.counts();
+
+            const AllocationScope raster_scope;
+            const auto raster_start = std::chrono::steady_clock::now();
+            draw_model(screen, *model, zbuf, shader, request.eye, arena);
+            raster_ms = milliseconds(std::chrono::steady_clock::now() - raster_start).count();
+            allocations.raster = raster_scope.counts();
+
+            // Released at the end of the frame, so that a frame which outgrew the arena also pays for growing it
+            arena.reset();
+        };
+
+        if (request.shader == "simple")
+        {
+            SimpleShader shader(*model, model_mat, view_mat, proj_mat, viewport_mat, request.light);
+            render(shader);
+        }
+        else if (request.shader == "gouraud")
+        {
+            GouraudShader shader(*model, model_mat, view_mat, proj_mat, viewport_mat, request.light);
+            render(shader);
+        }
+        else if (request.shader == "normal")
+        {
+            NormalShader shader(*model, model_mat, view_mat, proj_mat, viewport_mat, request.light);
+            render(shader);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown shader " + request.shader);
+        }
+
+        {
+            const AllocationScope output_scope;
+            write_output(request.output);
+            allocations.output = output_scope.counts();
+        }
+
+        std::ostringstream response;
+        response << std::fixed << std::setprecision(2)
+                 << "ok total_ms=" << milliseconds(std::chrono::steady_clock::now() - start_time).count()
+                 << " raster_ms=" << raster_ms
+                 << " model_cached=" << cached
+                 << " allocations=request:" << allocations.request.n_allocations
+                 << ",setup:" << allocations.setup.n_allocations
+                 << ",raster:" << allocations.raster.n_allocations
+                 << ",output:" << allocations.output.n_allocations;
+        return response.str();
+    }
+    catch (const std::exception &e)
+    {
+        return std::string("error ") + e.what();
+    }
+}
+
+const RequestAllocations &RenderServer::last_allocations() const
+{
+    return allocations;
+}
+
+void RenderServer::serve(std::istream &input, std::ostream &output)
+{
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (line == "quit")
+        {
+            break;
+        }
+
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        output << handle(line) << std::endl;
+    }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Removes the socket a previous server left behind. Anything else at the path is kept, so a mistyped
+// path cannot delete a regular file.
+void remove_stale_socket(const std::string &socket_path)
+{
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return;
+        }
+
+        throw std::runtime_error("Failed to check " + socket_path + ": " + std::strerror(errno));
+    }
+
+    if (!S_ISSOCK(status.st_mode))
+    {
+        throw std::runtime_error(socket_path + " exists and is not a socket");
+    }
+
+    unlink(socket_path.c_str());
+}
+#endif
+
+void RenderServer::serve_socket(const std::string &socket_path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path is too long");
+    }
+
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    remove_stale_socket(socket_path);
+    const int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0)
+    {
+        throw std::runtime_error("Failed to create a socket for " + socket_path + ": " + std::strerror(errno));
+    }
+
+    if (bind(server_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(server_fd, 8) != 0)
+    {
+        const int error = errno;
+        close(server_fd);
+        throw std::runtime_error("Failed to listen on " + socket_path + ": " + std::strerror(error));
+    }
+
+    // A client that disconnects early must not kill the server while the response is written
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Clients are served one after another, a "quit" line from any of them stops the server
+    bool running = true;
+    while (running)
+    {
+        const int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0)
+        {
+            // A signal or a client that gave up before it was accepted, any other error would repeat forever
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            const int error = errno;
+            close(server_fd);
+            unlink(socket_path.c_str());
+            throw std::runtime_error("Failed to accept a connection on " + socket_path + ": " + std::strerror(error));
+        }
+
+        std::string pending;
+        char buffer[4096];
+        ssize_t n_read = 0;
+        while (running && (n_read = read(client_fd, buffer, sizeof(buffer))) > 0)
+        {
+            pending.append(buffer, n_read);
+
+            size_t line_end = 0;
+            while (running && (line_end = pending.find('\n')) != std::string::npos)
+            {
+                const std::string line = pending.substr(0, line_end);
+                pending.erase(0, line_end + 1);
+                if (line == "quit")
+                {
+                    running = false;
+                    break;
+                }
+
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                {
+                    continue;
+                }
+
+                const std::string response = handle(line) + "\n";
+                for (size_t written = 0; written < response.size();)
+                {
+                    const ssize_t n_written = write(client_fd, response.data() + written, response.size() - written);
+                    if (n_written <= 0)
+                    {
+                        break;
+                    }
+
+                    written += n_written;
+                }
+            }
+        }
+
+        close(client_fd);
+    }
+
+    close(server_fd);
+    unlink(socket_path.c_str());
+#else
+    throw std::runtime_error("Unix domain sockets are not supported on this platform");
+#endif
+}
@@ -0,0 +1,95 @@
+#ifndef __RENDER_SERVER_HPP__
+#define __RENDER_SERVER_HPP__
+
+#include <istream>
+#include <list>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "math/linalg.hpp"
+#include "memory/allocation_stats.hpp"
+#include "memory/frame_arena.hpp"
+#include "rendering/model.hpp"
+
+// One request per line, made of key=value pairs separated by spaces, e.g.
+//   model=model/model.obj eye=1,1,3 light=0,0,1 shader=normal width=800 height=800 output=thumb.png
+// Outputs starting with shm: are written as raw RGBA into a POSIX shared memory object of that name.
+// The width and height are at most 8192.
+struct RenderRequest
+{
+    std::string model_filename, normal_map_filename, specular_map_filename, diffuse_map_filename;
+    std::string shader, output;
+    FloatVector eye, center, up, light;
+    int width, height;
+
+    RenderRequest();
+    static RenderRequest parse(const std::string &line);
+};
+
+// Least recently used models are evicted once the capacity is exceeded
+class ModelCache
+{
+private:
+    const size_t capacity;
+    std::list<std::pair<std::string, std::shared_ptr<const Model>>> entries;
+    std::unordered_map<std::string, decltype(entries)::iterator> index;
+
+    void insert(const std::string &key, const std::shared_ptr<const Model> &model);
+
+public:
+    explicit ModelCache(size_t capacity);
+
+    // Sets hit to whether the model was already loaded
+    std::shared_ptr<const Model> get(const RenderRequest &request, bool &hit);
+
+    // Loads the models of the requests that are not cached yet, all at once. Models beyond the capacity would
+    // evict the first ones right away, they are skipped. Returns a message per model that was skipped or failed.
+    std::vector<std::string> preload(const std::vector<RenderRequest> &requests);
+};
+
+// Heap allocations made while handling a request, by stage
+struct RequestAllocations
+{
+    // Parsing the request and looking up the model
+    AllocationCounts request;
+    // Framebuffers and shader set up, and the rasterization: a repeated request allocates nothing in these stages
+    AllocationCounts setup, raster;
+    // Writing the image
+    AllocationCounts output;
+};
+
+// Keeps the models, the framebuffers and the frame arena between requests, so that a request costs little more
+// than rasterization
+class RenderServer
+{
+private:
+    ModelCache models;
+    sf::Image screen;
+    std::vector<std::vector<float>> zbuf;
+    FrameArena arena;
+    RequestAllocations allocations;
+
+    void prepare_framebuffers(int width, int height);
+    void write_output(const std::string &output);
+
+public:
+    explicit RenderServer(size_t model_cache_capacity = 8);
+
+    // Loads the models with the default maps into the cache before the first request
+    std::vector<std::string> preload(const std::vector<std::string> &model_filenames);
+
+    // Renders the request and returns the response line
+    std::string handle(const std::string &line);
+
+    const RequestAllocations &last_allocations() const;
+
+    void serve(std::istream &input, std::ostream &output);
+    void serve_socket(const std::string &socket_path);
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "server/sort_last.hpp"
+
+const std::uint32_t layer_magic = 0x52594c54; // "TLYR"
+const std::uint32_t layer_version = 1;
+
+#if defined(__unix__) || defined(__APPLE__)
+void read_bytes(int fd, void *data, size_t n_bytes)
+{
+    char *bytes = static_cast<char *>(data);
+    while (n_bytes > 0)
+    {
+        const ssize_t n_read = read(fd, bytes, n_bytes);
+        if (n_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n_read <= 0)
+        {
+            throw std::runtime_error("Truncated layer");
+        }
+
+        bytes += n_read;
+        n_bytes -= n_read;
+    }
+}
+#endif
+
+void write_layer(std::ostream &stream, const sf::Image &screen, const std::vector<std::vector<float>> &zbuf)
+{
+    const auto screen_size = screen.getSize();
+    const std::uint32_t header[] = {layer_magic, layer_version, screen_size.x, screen_size.y};
+    stream.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    const size_t row_bytes = static_cast<size_t>(screen_size.x) * 4;
+    std::vector<float> depths(screen_size.x);
+    for (unsigned int y = 0; y < screen_size.y; ++y)
+    {
+        for (unsigned int x = 0; x < screen_size.x; ++x)
+        {
+            depths[x] = zbuf[x][y];
+        }
+
+        stream.write(reinterpret_cast<const char *>(screen.getPixelsPtr() + y * row_bytes), row_bytes);
+        stream.write(reinterpret_cast<const char *>(depths.data()), depths.size() * sizeof(float));
+    }
+
+    stream.flush();
+    if (stream.fail())
+    {
+        throw std::runtime_error("Failed to write the layer");
+    }
+}
+
+void composite_layer(int fd, sf::Image &screen, std::vector<std::vector<float>> &zbuf)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    const auto screen_size = screen.getSize();
+    std::uint32_t header[4] = {};
+    read_bytes(fd, header, sizeof(header));
+    if (header[0] != layer_magic || header[1] != layer_version)
+    {
+        throw std::runtime_error("Not a layer");
+    }
+
+    if (header[2] != screen_size.x || header[3] != screen_size.y)
+    {
+        throw std::runtime_error("The layer does not match the screen size");
+    }
+
+    std::vector<std::uint8_t> colors(static_cast<size_t>(screen_size.x) * 4);
+    std::vector<float> depths(screen_size.x);
+    for (unsigned int y = 0; y < screen_size.y; ++y)
+    {
+        read_bytes(fd, colors.data(), colors.size());
+        read_bytes(fd, depths.data(), depths.size() * sizeof(float));
+
+        for (unsigned int x = 0; x < screen_size.x; ++x)
+        {
+            if (depths[x] < zbuf[x][y])
+            {
+                continue;
+            }
+
+            zbuf[x][y] = depths[x];
+            const std::uint8_t *color = colors.data() + x * 4;
+            screen.setPixel(x, y, sf::Color(color[0], color[1], color[2], color[3]));
+        }
+    }
+#else
+    throw std::runtime_error("Sort-last rendering is not supported on this platform");
+#endif
+}
+
+size_t max_sort_last_workers()
+{
+    return 4 * static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+void render_sort_last(
+    const std::vector<std::string> &command,
+    size_t n_workers,
+    sf::Image &screen,
+    std::vector<std::vector<float>> &zbuf)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (command.empty() || n_workers == 0)
+    {
+        throw std::runtime_error("Invalid worker command");
+    }
+
+    if (n_workers > max_sort_last_workers())
+    {
+        throw std::runtime_error("At most " + std::to_string(max_sort_last_workers()) + " workers are allowed");
+    }
+
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    std::string error;
+    for (size_t worker_idx = 0; worker_idx < n_workers; ++worker_idx)
+    {
+        // Built before forking, the child only calls async-signal-safe functions
+        std::vector<std::string> arguments = command;
+        arguments.push_back("--worker");
+        arguments.push_back(std::to_string(worker_idx) + "/" + std::to_string(n_workers));
+
+        std::vector<char *> argv;
+        for (std::string &argument : arguments)
+        {
+            argv.push_back(&argument[0]);
+        }
+
+        argv.push_back(nullptr);
+
+        int pipe_fds[2];
+        if (pipe(pipe_fds) != 0)
+        {
+            error = "Failed to create a pipe";
+            break;
+        }
+
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            // The frames of the other workers must see end of file once their workers exit
+            for (const int fd : fds)
+            {
+                close(fd);
+            }
+
+            close(pipe_fds[0]);
+            if (dup2(pipe_fds[1], STDOUT_FILENO) < 0)
+            {
+                _exit(127);
+            }
+
+            close(pipe_fds[1]);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+
+        close(pipe_fds[1]);
+        if (pid < 0)
+        {
+            close(pipe_fds[0]);
+            error = "Failed to start a worker";
+            break;
+        }
+
+        pids.push_back(pid);
+        fds.push_back(pipe_fds[0]);
+    }
+
+    // Every started worker is read to the end or until its frame turns out broken, and always reaped
+    for (size_t worker_idx = 0; worker_idx < fds.size(); ++worker_idx)
+    {
+        if (error.empty())
+        {
+            try
+            {
+                composite_layer(fds[worker_idx], screen, zbuf);
+            }
+            catch (const std::runtime_error &e)
+            {
+                error = "Worker " + std::to_string(worker_idx) + ": " + e.what();
+            }
+        }
+
+        close(fds[worker_idx]);
+    }
+
+    for (size_t worker_idx = 0; worker_idx < pids.size(); ++worker_idx)
+    {
+        int status = 0;
+        while (waitpid(pids[worker_idx], &status, 0) < 0 && errno == EINTR)
+        {
+        }
+
+        if (error.empty() && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+        {
+            error = "Worker " + std::to_string(worker_idx) + " failed";
+        }
+    }
+
+    if (!error.empty())
+    {
+        throw std::runtime_error(error);
+    }
+#else
+    throw std::runtime_error("Sort-last rendering is not supported on this platform");
+#endif
+}
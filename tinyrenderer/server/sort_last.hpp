@@ -0,0 +1,33 @@
+#ifndef __SORT_LAST_HPP__
+#define __SORT_LAST_HPP__
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+// Sort-last rendering: every worker draws a disjoint part of the scene into a full frame, the frames are merged
+// by depth. A frame travels over a byte stream as a header followed by one block per row, made of the colors of
+// the row and then their depths, so the compositor never holds more than a row of a worker.
+
+// Writes the frame and its depths to the stream
+void write_layer(std::ostream &stream, const sf::Image &screen, const std::vector<std::vector<float>> &zbuf);
+
+// Reads a frame from the file descriptor and keeps the pixels that are at least as close as those of screen and zbuf.
+// On equal depths the new pixel wins, like a later fragment in the depth test of draw_triangle. Across workers
+// "later" follows the worker order rather than the order the chunks would be drawn in by a single process.
+void composite_layer(int fd, sf::Image &screen, std::vector<std::vector<float>> &zbuf);
+
+// Four processes per hardware thread, more would only add memory and composite time
+size_t max_sort_last_workers();
+
+// Runs the command in n_workers processes with "--worker I/N" appended and composites the frames they write to
+// their standard output. The workers render in parallel, their frames are merged in worker order as they arrive.
+void render_sort_last(
+    const std::vector<std::string> &command,
+    size_t n_workers,
+    sf::Image &screen,
+    std::vector<std::vector<float>> &zbuf);
+
+#endif